@@ -0,0 +1,408 @@
+/*
+  audio sample conversion for the LTC decoder
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "audioconv.h"
+#include "error.h"
+#include <string.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+
+// scaling of the input formats to the range -127..127:
+#define SCALE_S16 0.00387573f
+#define SCALE_S32 5.9139e-08f
+#define SCALE_FLT 127.0f
+
+typedef void (*convert_fun_t)(ltcsnd_sample_t*, uint8_t**, uint32_t, uint32_t, AVSampleFormat, uint32_t);
+
+void convert_audio_samples_scalar(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel)
+{
+  switch( fmt ){
+  case AV_SAMPLE_FMT_S16P :
+    {
+      int16_t* lbuf((int16_t*)(inbuffer[channel]));
+      for(uint32_t k=0;k<size;++k){
+        outbuffer[k] = 128+0.00387573*lbuf[k];
+      }
+      break;
+    }
+  case AV_SAMPLE_FMT_S16 :
+    {
+      int16_t* lbuf((int16_t*)(inbuffer[0]));
+      for(uint32_t k=0;k<size;++k){
+        outbuffer[k] = 128+0.00387573*lbuf[k*channels+channel];
+      }
+      break;
+    }
+  case AV_SAMPLE_FMT_U8 :
+    {
+      uint8_t* lbuf((uint8_t*)(inbuffer[0]));
+      for(uint32_t k=0;k<size;++k)
+        outbuffer[k] = lbuf[k*channels+channel];
+      break;
+    }
+  case AV_SAMPLE_FMT_S32 :
+    {
+      int32_t* lbuf((int32_t*)(inbuffer[0]));
+      for(uint32_t k=0;k<size;++k)
+        outbuffer[k] = 128+5.9139e-08*lbuf[k*channels+channel];
+      break;
+    }
+  case AV_SAMPLE_FMT_FLT :
+    {
+      float* lbuf((float*)(inbuffer[0]));
+      for(uint32_t k=0;k<size;++k)
+        outbuffer[k] = 128+127*lbuf[k*channels+channel];
+      break;
+    }
+  case AV_SAMPLE_FMT_FLTP :
+    {
+      float* lbuf((float*)(inbuffer[channel]));
+      for(uint32_t k=0;k<size;++k){
+        outbuffer[k] = 128+127*lbuf[k];
+      }
+      break;
+    }
+  default:
+    throw error_msg_t(__FILE__,__LINE__,"Unsupported sample format \"%s\".",
+                      av_get_sample_fmt_name( fmt ) );
+  }
+}
+
+/*
+  SSE2 kernels: four samples are loaded, converted to float, scaled
+  and truncated; sixteen results are packed to unsigned bytes with
+  saturation.
+ */
+
+static inline __m128 sse2_load(const int16_t* p)
+{
+  __m128i v(_mm_loadl_epi64((const __m128i*)p));
+  return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v,v),16));
+}
+
+static inline __m128 sse2_load(const int16_t* p, uint32_t s)
+{
+  return _mm_cvtepi32_ps(_mm_set_epi32(p[3*s],p[2*s],p[s],p[0]));
+}
+
+static inline __m128 sse2_load(const int32_t* p)
+{
+  return _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)p));
+}
+
+static inline __m128 sse2_load(const int32_t* p, uint32_t s)
+{
+  return _mm_cvtepi32_ps(_mm_set_epi32(p[3*s],p[2*s],p[s],p[0]));
+}
+
+static inline __m128 sse2_load(const float* p)
+{
+  return _mm_loadu_ps(p);
+}
+
+static inline __m128 sse2_load(const float* p, uint32_t s)
+{
+  return _mm_set_ps(p[3*s],p[2*s],p[s],p[0]);
+}
+
+static inline __m128i sse2_scale(__m128 x, __m128 scale)
+{
+  return _mm_cvttps_epi32(_mm_add_ps(_mm_set1_ps(128.0f),_mm_mul_ps(x,scale)));
+}
+
+static inline void sse2_store16(ltcsnd_sample_t* out, __m128 a, __m128 b, __m128 c, __m128 d, __m128 scale)
+{
+  __m128i ab(_mm_packs_epi32(sse2_scale(a,scale),sse2_scale(b,scale)));
+  __m128i cd(_mm_packs_epi32(sse2_scale(c,scale),sse2_scale(d,scale)));
+  _mm_storeu_si128((__m128i*)out,_mm_packus_epi16(ab,cd));
+}
+
+template<class T> static void sse2_kernel(ltcsnd_sample_t* out, const T* in, uint32_t size, uint32_t stride, float scale)
+{
+  const __m128 vscale(_mm_set1_ps(scale));
+  uint32_t k(0);
+  if( stride == 1 ){
+    for(;k+16<=size;k+=16)
+      sse2_store16(out+k,sse2_load(in+k),sse2_load(in+k+4),sse2_load(in+k+8),sse2_load(in+k+12),vscale);
+  }else{
+    for(;k+16<=size;k+=16){
+      const T* p(in+k*stride);
+      sse2_store16(out+k,sse2_load(p,stride),sse2_load(p+4*stride,stride),
+                   sse2_load(p+8*stride,stride),sse2_load(p+12*stride,stride),vscale);
+    }
+  }
+  for(;k<size;++k)
+    out[k] = 128.0f+scale*in[k*stride];
+}
+
+static void convert_audio_samples_sse2(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel)
+{
+  switch( fmt ){
+  case AV_SAMPLE_FMT_S16P :
+    sse2_kernel(outbuffer,(const int16_t*)(inbuffer[channel]),size,1,SCALE_S16);
+    break;
+  case AV_SAMPLE_FMT_S16 :
+    sse2_kernel(outbuffer,(const int16_t*)(inbuffer[0])+channel,size,channels,SCALE_S16);
+    break;
+  case AV_SAMPLE_FMT_S32 :
+    sse2_kernel(outbuffer,(const int32_t*)(inbuffer[0])+channel,size,channels,SCALE_S32);
+    break;
+  case AV_SAMPLE_FMT_FLT :
+    sse2_kernel(outbuffer,(const float*)(inbuffer[0])+channel,size,channels,SCALE_FLT);
+    break;
+  case AV_SAMPLE_FMT_FLTP :
+    sse2_kernel(outbuffer,(const float*)(inbuffer[channel]),size,1,SCALE_FLT);
+    break;
+  case AV_SAMPLE_FMT_U8 :
+    if( channels == 1 )
+      memcpy(outbuffer,inbuffer[0],size);
+    else
+      convert_audio_samples_scalar(outbuffer,inbuffer,size,channels,fmt,channel);
+    break;
+  default:
+    convert_audio_samples_scalar(outbuffer,inbuffer,size,channels,fmt,channel);
+  }
+}
+
+/*
+  AVX2 kernels: eight samples per step. Interleaved input is loaded
+  element by element; gather instructions turned out to be slower than
+  scalar loads on the CPUs we measured.
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256 avx2_load(const int16_t* p)
+{
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)p)));
+}
+
+static inline AVX2 __m256 avx2_load(const int16_t* p, uint32_t s)
+{
+  return _mm256_cvtepi32_ps(_mm256_setr_epi32(p[0],p[s],p[2*s],p[3*s],p[4*s],p[5*s],p[6*s],p[7*s]));
+}
+
+static inline AVX2 __m256 avx2_load(const int32_t* p)
+{
+  return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)p));
+}
+
+static inline AVX2 __m256 avx2_load(const int32_t* p, uint32_t s)
+{
+  return _mm256_cvtepi32_ps(_mm256_setr_epi32(p[0],p[s],p[2*s],p[3*s],p[4*s],p[5*s],p[6*s],p[7*s]));
+}
+
+static inline AVX2 __m256 avx2_load(const float* p)
+{
+  return _mm256_loadu_ps(p);
+}
+
+static inline AVX2 __m256 avx2_load(const float* p, uint32_t s)
+{
+  return _mm256_setr_ps(p[0],p[s],p[2*s],p[3*s],p[4*s],p[5*s],p[6*s],p[7*s]);
+}
+
+static inline AVX2 void avx2_store8(ltcsnd_sample_t* out, __m256 x, __m256 scale)
+{
+  __m256i v(_mm256_cvttps_epi32(_mm256_add_ps(_mm256_set1_ps(128.0f),_mm256_mul_ps(x,scale))));
+  __m128i w(_mm_packs_epi32(_mm256_castsi256_si128(v),_mm256_extracti128_si256(v,1)));
+  _mm_storel_epi64((__m128i*)out,_mm_packus_epi16(w,w));
+}
+
+template<class T> static AVX2 void avx2_kernel(ltcsnd_sample_t* out, const T* in, uint32_t size, uint32_t stride, float scale)
+{
+  const __m256 vscale(_mm256_set1_ps(scale));
+  uint32_t k(0);
+  if( stride == 1 ){
+    for(;k+8<=size;k+=8)
+      avx2_store8(out+k,avx2_load(in+k),vscale);
+  }else{
+    for(;k+8<=size;k+=8)
+      avx2_store8(out+k,avx2_load(in+k*stride,stride),vscale);
+  }
+  for(;k<size;++k)
+    out[k] = 128.0f+scale*in[k*stride];
+}
+
+static AVX2 void convert_audio_samples_avx2(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel)
+{
+  switch( fmt ){
+  case AV_SAMPLE_FMT_S16P :
+    avx2_kernel(outbuffer,(const int16_t*)(inbuffer[channel]),size,1,SCALE_S16);
+    break;
+  case AV_SAMPLE_FMT_S16 :
+    avx2_kernel(outbuffer,(const int16_t*)(inbuffer[0])+channel,size,channels,SCALE_S16);
+    break;
+  case AV_SAMPLE_FMT_S32 :
+    avx2_kernel(outbuffer,(const int32_t*)(inbuffer[0])+channel,size,channels,SCALE_S32);
+    break;
+  case AV_SAMPLE_FMT_FLT :
+    avx2_kernel(outbuffer,(const float*)(inbuffer[0])+channel,size,channels,SCALE_FLT);
+    break;
+  case AV_SAMPLE_FMT_FLTP :
+    avx2_kernel(outbuffer,(const float*)(inbuffer[channel]),size,1,SCALE_FLT);
+    break;
+  case AV_SAMPLE_FMT_U8 :
+    if( channels == 1 )
+      memcpy(outbuffer,inbuffer[0],size);
+    else
+      convert_audio_samples_scalar(outbuffer,inbuffer,size,channels,fmt,channel);
+    break;
+  default:
+    convert_audio_samples_scalar(outbuffer,inbuffer,size,channels,fmt,channel);
+  }
+}
+
+static bool isa_supported(const char* isa)
+{
+  __builtin_cpu_init();
+  if( strcmp(isa,"scalar") == 0 )
+    return true;
+  if( strcmp(isa,"sse2") == 0 )
+    return __builtin_cpu_supports("sse2");
+  if( strcmp(isa,"avx2") == 0 )
+    return __builtin_cpu_supports("avx2");
+  return false;
+}
+
+static const char* best_isa()
+{
+  if( isa_supported("avx2") )
+    return "avx2";
+  if( isa_supported("sse2") )
+    return "sse2";
+  return "scalar";
+}
+
+static convert_fun_t isa_fun(const char* isa)
+{
+  if( strcmp(isa,"avx2") == 0 )
+    return convert_audio_samples_avx2;
+  if( strcmp(isa,"sse2") == 0 )
+    return convert_audio_samples_sse2;
+  return convert_audio_samples_scalar;
+}
+
+static convert_fun_t convert_fun(isa_fun(best_isa()));
+
+void convert_audio_samples(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel)
+{
+  convert_fun(outbuffer,inbuffer,size,channels,fmt,channel);
+}
+
+bool convert_audio_samples_select(const char* isa)
+{
+  if( !isa_supported(isa) )
+    return false;
+  convert_fun = isa_fun(isa);
+  return true;
+}
+
+const char* convert_audio_samples_isa()
+{
+  if( convert_fun == convert_audio_samples_avx2 )
+    return "avx2";
+  if( convert_fun == convert_audio_samples_sse2 )
+    return "sse2";
+  return "scalar";
+}
+
+/**
+   Average of neighboring samples, 2*'npairs' samples from 'in' to
+   'npairs' samples in 'out'. 'out' may be equal to 'in'.
+ */
+static void halve_samples(ltcsnd_sample_t* out, const ltcsnd_sample_t* in, uint32_t npairs)
+{
+  uint32_t k(0);
+  const __m128i lowbyte(_mm_set1_epi16(0x00ff));
+  for(;k+16<=npairs;k+=16){
+    __m128i a(_mm_loadu_si128((const __m128i*)(in+2*k)));
+    __m128i b(_mm_loadu_si128((const __m128i*)(in+2*k+16)));
+    // even and odd samples as 16 bit words, rounded average as in
+    // the scalar tail:
+    a = _mm_avg_epu16(_mm_and_si128(a,lowbyte),_mm_srli_epi16(a,8));
+    b = _mm_avg_epu16(_mm_and_si128(b,lowbyte),_mm_srli_epi16(b,8));
+    _mm_storeu_si128((__m128i*)(out+k),_mm_packus_epi16(a,b));
+  }
+  for(;k<npairs;++k)
+    out[k] = (in[2*k]+in[2*k+1]+1) >> 1;
+}
+
+ltc_decimator_t::ltc_decimator_t(uint32_t factor_)
+  : factor(factor_),
+    base(0),
+    next(0),
+    count(0),
+    nrem(0),
+    b_started(false)
+{
+  if( (factor != 1) && (factor != 2) && (factor != 4) )
+    throw error_msg_t(__FILE__,__LINE__,"Invalid decimation factor %d (1, 2 or 4).",factor);
+}
+
+void ltc_decimator_t::reset()
+{
+  b_started = false;
+  nrem = 0;
+  count = 0;
+}
+
+uint32_t ltc_decimator_t::process(ltcsnd_sample_t* buf, uint32_t n, int64_t posinfo, int64_t& outpos)
+{
+  if( !b_started || (posinfo != next) ){
+    // start, or discontinuity: drop the incomplete block, and keep the
+    // mapping of the output positions continuous:
+    nrem = 0;
+    base = posinfo - count*factor;
+    b_started = true;
+  }
+  next = posinfo + n;
+  outpos = count;
+  uint32_t in(0);
+  uint32_t out(0);
+  if( nrem ){
+    // complete the block left over from the previous call:
+    while( (nrem < factor) && (in < n) )
+      rem[nrem++] = buf[in++];
+    if( nrem < factor )
+      return 0;
+    if( factor == 4 ){
+      halve_samples(rem,rem,2);
+    }
+    halve_samples(buf,rem,1);
+    out = 1;
+    nrem = 0;
+  }
+  uint32_t nblocks((n-in)/factor);
+  halve_samples(buf+out,buf+in,nblocks*factor/2);
+  if( factor == 4 )
+    halve_samples(buf+out,buf+out,nblocks);
+  out += nblocks;
+  in += nblocks*factor;
+  while( in < n )
+    rem[nrem++] = buf[in++];
+  count += out;
+  return out;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,111 @@
+/*
+  audio sample conversion for the LTC decoder
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef AUDIOCONV_H
+#define AUDIOCONV_H
+
+#include <stdint.h>
+#include <ltc.h>
+
+extern "C" {
+
+#include <libavutil/samplefmt.h>
+
+}
+
+/**
+   Extract one channel of a decoded audio frame and convert it to
+   unsigned 8 bit LTC decoder samples.
+
+   The kernel set (scalar, SSE2 or AVX2) is selected at run time.
+
+   @param outbuffer Output buffer, at least 'size' samples
+   @param inbuffer Data pointers of the decoded frame (AVFrame::data)
+   @param size Number of samples per channel
+   @param channels Number of channels
+   @param fmt Sample format of the decoded frame
+   @param channel Channel to be extracted
+ */
+void convert_audio_samples(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel);
+
+/**
+   Scalar reference implementation of convert_audio_samples().
+ */
+void convert_audio_samples_scalar(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel);
+
+/**
+   Select a kernel set by name ("scalar", "sse2" or "avx2").
+
+   Returns false if the kernel set is unknown or not supported by this
+   CPU; the selection is then unchanged.
+ */
+bool convert_audio_samples_select(const char* isa);
+
+/**
+   Name of the currently selected kernel set.
+ */
+const char* convert_audio_samples_isa();
+
+/**
+   Anti-alias filter and decimation of LTC decoder samples by 2 or 4,
+   to reduce the number of samples passed to libltc.
+
+   The filter averages neighboring samples (applied twice for a factor
+   of 4). Input blocks are assumed to be contiguous; a block that does
+   not start where the previous one ended restarts the filter.
+ */
+class ltc_decimator_t {
+public:
+  ltc_decimator_t(uint32_t factor_ = 1);
+  /**
+     Forget all state, e.g. after a seek.
+   */
+  void reset();
+  /**
+     Decimate 'n' samples in place.
+
+     @param buf Samples, replaced by the decimated samples
+     @param n Number of input samples
+     @param posinfo Position of the first input sample
+     @param outpos Position of the first output sample, in decimated samples
+     @return Number of output samples
+   */
+  uint32_t process(ltcsnd_sample_t* buf, uint32_t n, int64_t posinfo, int64_t& outpos);
+  /**
+     Input sample position of the start of decimated sample 'pos',
+     accurate within 'factor' samples.
+   */
+  int64_t position(int64_t pos) const { return base + pos*factor; };
+  uint32_t factor;
+private:
+  int64_t base;
+  int64_t next;
+  int64_t count;
+  ltcsnd_sample_t rem[4];
+  uint32_t nrem;
+  bool b_started;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,132 @@
+/*
+  audioconv_bench - throughput of the audio sample conversion kernels
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "audioconv.h"
+#include "error.h"
+
+// samples per channel and call, a typical decoded audio frame:
+#define FRAMESIZE 1024
+// minimum measurement time per kernel in seconds:
+#define MINTIME 0.2
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/**
+   Fill a buffer with a full-scale square wave with some noise.
+ */
+static void fill(std::vector<uint8_t>& buf, AVSampleFormat fmt)
+{
+  uint32_t bps(av_get_bytes_per_sample(fmt));
+  uint32_t n(buf.size()/bps);
+  for(uint32_t k=0;k<n;++k){
+    double v(((k/20) & 1) ? 0.9 : -0.9);
+    v += 0.05*(rand()/(double)RAND_MAX-0.5);
+    switch( fmt ){
+    case AV_SAMPLE_FMT_U8 :
+      buf[k] = 128+127*v;
+      break;
+    case AV_SAMPLE_FMT_S16 :
+    case AV_SAMPLE_FMT_S16P :
+      ((int16_t*)(&(buf[0])))[k] = 32767*v;
+      break;
+    case AV_SAMPLE_FMT_S32 :
+      ((int32_t*)(&(buf[0])))[k] = 2147483647*v;
+      break;
+    default:
+      ((float*)(&(buf[0])))[k] = v;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  try{
+    const AVSampleFormat fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S32,
+                                    AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_U8 };
+    const uint32_t channelcounts[] = { 1, 2, 4, 8 };
+    const char* isas[] = { "scalar", "sse2", "avx2" };
+    std::vector<ltcsnd_sample_t> out(FRAMESIZE);
+    std::vector<ltcsnd_sample_t> ref(FRAMESIZE);
+    printf("%-6s %3s %-7s %12s %8s\n","format","ch","kernel","samples/s","speedup");
+    for(uint32_t f=0;f<sizeof(fmts)/sizeof(fmts[0]);++f){
+      AVSampleFormat fmt(fmts[f]);
+      for(uint32_t c=0;c<sizeof(channelcounts)/sizeof(channelcounts[0]);++c){
+        uint32_t channels(channelcounts[c]);
+        uint32_t bps(av_get_bytes_per_sample(fmt));
+        std::vector<std::vector<uint8_t> > bufs;
+        std::vector<uint8_t*> data;
+        if( av_sample_fmt_is_planar(fmt) ){
+          bufs.resize(channels,std::vector<uint8_t>(FRAMESIZE*bps));
+        }else{
+          bufs.resize(1,std::vector<uint8_t>(FRAMESIZE*bps*channels));
+        }
+        for(uint32_t k=0;k<bufs.size();++k){
+          fill(bufs[k],fmt);
+          data.push_back(&(bufs[k][0]));
+        }
+        uint32_t channel(channels-1);
+        convert_audio_samples_scalar(&(ref[0]),&(data[0]),FRAMESIZE,channels,fmt,channel);
+        double scalar_rate(0);
+        for(uint32_t i=0;i<sizeof(isas)/sizeof(isas[0]);++i){
+          if( !convert_audio_samples_select(isas[i]) )
+            continue;
+          convert_audio_samples(&(out[0]),&(data[0]),FRAMESIZE,channels,fmt,channel);
+          // allow rounding differences of one step between kernels:
+          for(uint32_t k=0;k<FRAMESIZE;++k)
+            if( abs((int)out[k]-(int)ref[k]) > 1 )
+              throw error_msg_t(__FILE__,__LINE__,"Kernel %s differs from scalar reference for %s, %d channels (sample %d: %d/%d).",
+                                isas[i],av_get_sample_fmt_name(fmt),channels,k,out[k],ref[k]);
+          uint64_t nsamples(0);
+          double t0(now());
+          double t(0);
+          while( (t = now()-t0) < MINTIME ){
+            for(uint32_t rep=0;rep<100;++rep)
+              convert_audio_samples(&(out[0]),&(data[0]),FRAMESIZE,channels,fmt,channel);
+            nsamples += 100*FRAMESIZE;
+          }
+          double rate(nsamples/t);
+          if( i == 0 )
+            scalar_rate = rate;
+          printf("%-6s %3d %-7s %12.4g %7.2fx\n",av_get_sample_fmt_name(fmt),channels,isas[i],rate,rate/scalar_rate);
+        }
+      }
+    }
+  }
+  catch( const std::exception& e ){
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
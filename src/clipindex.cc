@@ -0,0 +1,89 @@
+/*
+  clipindex - index of decoded files for the watch daemon
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "clipindex.h"
+
+clip_index_t::clip_index_t()
+  : next_number(0),
+    b_modified(false)
+{
+}
+
+void clip_index_t::set(const std::string& path, const index_entry_t& entry)
+{
+  if( numbers.find(path) == numbers.end() )
+    numbers[path] = next_number++;
+  index_entry_t& e(files[path]);
+  e = entry;
+  for(std::vector<clip_t>::iterator it=e.clips.begin();it!=e.clips.end();++it)
+    it->camera = numbers[path];
+  b_modified = true;
+}
+
+void clip_index_t::remove(const std::string& path)
+{
+  if( files.erase(path) )
+    b_modified = true;
+}
+
+void clip_index_t::remove_dir(const std::string& dir)
+{
+  std::string prefix(dir+"/");
+  std::map<std::string,index_entry_t>::iterator it(files.lower_bound(prefix));
+  while( (it != files.end()) && (it->first.compare(0,prefix.size(),prefix) == 0) ){
+    files.erase(it++);
+    b_modified = true;
+  }
+}
+
+const index_entry_t* clip_index_t::find(const std::string& path) const
+{
+  std::map<std::string,index_entry_t>::const_iterator it(files.find(path));
+  if( it == files.end() )
+    return NULL;
+  return &(it->second);
+}
+
+void clip_index_t::covering(uint32_t frame, std::vector<const clip_t*>& result)
+{
+  if( b_modified ){
+    timeline = timeline_t();
+    for(std::map<std::string,index_entry_t>::const_iterator f=files.begin();f!=files.end();++f)
+      for(std::vector<clip_t>::const_iterator it=f->second.clips.begin();it!=f->second.clips.end();++it)
+        timeline.add(*it);
+    timeline.build();
+    b_modified = false;
+  }
+  timeline.covering(frame,result);
+}
+
+size_t clip_index_t::errors() const
+{
+  size_t n(0);
+  for(std::map<std::string,index_entry_t>::const_iterator f=files.begin();f!=files.end();++f)
+    if( !f->second.error.empty() )
+      ++n;
+  return n;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
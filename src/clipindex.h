@@ -0,0 +1,81 @@
+/*
+  clipindex - index of decoded files for the watch daemon
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef CLIPINDEX_H
+#define CLIPINDEX_H
+
+#include <map>
+#include "ltccache.h"
+#include "timeline.h"
+
+/**
+   Result of one file: its identity when it was decoded, and its sync
+   segments, or the error message.
+ */
+class index_entry_t {
+public:
+  file_id_t id;
+  std::vector<clip_t> clips;
+  std::string error;
+};
+
+/**
+   Decoded files by path, and the LTC timeline of all their clips.
+
+   The timeline is rebuilt on the first query after a change. Not
+   thread safe.
+ */
+class clip_index_t {
+public:
+  clip_index_t();
+  /**
+     Add or replace the result of a file. The clips are numbered by
+     file (clip_t::camera), in the order the files were first added.
+   */
+  void set(const std::string& path, const index_entry_t& entry);
+  void remove(const std::string& path);
+  /**
+     Remove all files in a directory and its subdirectories.
+   */
+  void remove_dir(const std::string& dir);
+  /**
+     Result of a file, or NULL if the file is not in the index.
+   */
+  const index_entry_t* find(const std::string& path) const;
+  /**
+     Clips covering LTC frame 'frame'.
+   */
+  void covering(uint32_t frame, std::vector<const clip_t*>& result);
+  size_t size() const { return files.size(); };
+  size_t errors() const;
+private:
+  std::map<std::string,index_entry_t> files;
+  std::map<std::string,uint32_t> numbers;
+  uint32_t next_number;
+  timeline_t timeline;
+  bool b_modified;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,1662 @@
+/*
+  decoder - LTC decoding and alignment of video files
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "decoder.h"
+#include "error.h"
+#include "audioconv.h"
+#include "workerpool.h"
+#include "stillwriter.h"
+#include "spscqueue.h"
+#include "mmapio.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <exception>
+#include <string.h>
+#include <unistd.h>
+
+#define LTC_QUEUE_LENGTH 160000
+// overlap of audio chunks decoded in parallel, in video frames:
+#define CHUNK_OVERLAP_FRAMES 8
+#define SAMPLEBUFFERSIZE (1<<17)
+// streaming mode: LTC frames kept behind the last resolved video
+// frame (to allow for frame reordering), in video frames:
+#define STREAM_REORDER_FRAMES 16
+// single-pass and streaming mode: maximum number of video frames
+// waiting for LTC (a frame this far behind the newest one cannot be
+// covered by LTC decoded later):
+#define STREAM_MAX_PENDING 1024
+// probe mode: length of decoded audio windows, in video frames:
+#define PROBE_WINDOW_FRAMES 16
+// probe mode: LTC frames dropped after a seek:
+#define PROBE_WARMUP_FRAMES 2
+// parallel export: limit of packets held back by all segments, in bytes:
+#define EXPORT_MAX_BUFFER (256<<20)
+// frame extraction: threads encoding still images:
+#define STILL_THREADS 4
+// frame extraction: decode on instead of seeking if the next frame is
+// at most this number of frames ahead:
+#define STILL_SEEK_FRAMES 64
+// follow mode: interval of checks for appended data, in microseconds:
+#define FOLLOW_POLL_INTERVAL 250000
+// follow mode: distance kept from the end of a growing file, in bytes
+// (larger than any packet):
+#define FOLLOW_MARGIN (16<<20)
+// first pass: storage reserved beyond the estimated number of frames:
+#define SCAN_RESERVE_FRAMES 256
+// pipelined first pass: audio packets between demuxer and decoder:
+#define PIPELINE_PACKETS 64
+// pipelined first pass: decoded sample buffers between decoder and LTC decoder:
+#define PIPELINE_BUFFERS 16
+
+/**
+   Append a video frame position, keeping the positions from 'first'
+   on in increasing order: packets are demuxed in decoding order, but
+   video frames are numbered in presentation order. Returns the number
+   of positions the frame moved back.
+ */
+static size_t insert_frame(std::vector<int64_t>& frames, size_t first, int64_t aframe)
+{
+  frames.push_back(aframe);
+  size_t k(frames.size()-1);
+  for(;(k > first) && (frames[k-1] > aframe);--k)
+    std::swap(frames[k-1],frames[k]);
+  return frames.size()-1-k;
+}
+
+/**
+   Split a file name into stem and extension (including the dot).
+ */
+static void split_extension(const std::string& fname, std::string& stem, std::string& ext)
+{
+  stem = fname;
+  ext.clear();
+  size_t dot(fname.rfind('.'));
+  if( (dot != std::string::npos) && (fname.find('/',dot) == std::string::npos) ){
+    stem = fname.substr(0,dot);
+    ext = fname.substr(dot);
+  }
+}
+
+void decoder_t::scan_frame_map()
+{
+  select_index();
+  reserve_scan();
+  if( b_pipeline )
+    read_pipelined();
+  else
+    while( readframe() );
+}
+
+/**
+   Copy of an audio packet in a recycled buffer.
+ */
+class packet_slot_t {
+public:
+  packet_slot_t() : size(0), pts(AV_NOPTS_VALUE), dts(AV_NOPTS_VALUE), flags(0) {}
+  void assign(const AVPacket* packet)
+  {
+    if( data.size() < (size_t)packet->size + FF_INPUT_BUFFER_PADDING_SIZE )
+      data.resize(packet->size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if( packet->size )
+      memcpy(&(data[0]),packet->data,packet->size);
+    // decoders may read beyond the end of the packet:
+    memset(&(data[packet->size]),0,FF_INPUT_BUFFER_PADDING_SIZE);
+    size = packet->size;
+    pts = packet->pts;
+    dts = packet->dts;
+    flags = packet->flags;
+  }
+  void get(AVPacket* packet)
+  {
+    av_init_packet( packet );
+    packet->data = &(data[0]);
+    packet->size = size;
+    packet->pts = pts;
+    packet->dts = dts;
+    packet->flags = flags;
+  }
+private:
+  std::vector<uint8_t> data;
+  int size;
+  int64_t pts;
+  int64_t dts;
+  int flags;
+};
+
+/**
+   Converted samples of one audio frame, in a recycled buffer.
+ */
+class sample_slot_t {
+public:
+  sample_slot_t() : n(0), posinfo(0) {}
+  std::vector<ltcsnd_sample_t> samples;
+  uint32_t n;
+  int64_t posinfo;
+};
+
+/**
+   Pipelined alternative to 'while( readframe() );'.
+
+   Demuxing (this thread), audio decoding with sample conversion, and
+   LTC decoding with map insertion run in three threads, connected by
+   bounded single-producer/single-consumer queues. Packet data and
+   sample buffers are recycled by the queue slots. I/O stalls thus
+   overlap with decoding, and throughput is limited by the slowest
+   stage rather than the sum of all stages. Each thread uses its own
+   part of the decoder state (format context and video positions,
+   audio codec, LTC decoder and map), and its own stats counters.
+ */
+void decoder_t::read_pipelined()
+{
+  spsc_queue_t<packet_slot_t> packets(PIPELINE_PACKETS);
+  spsc_queue_t<sample_slot_t> buffers(PIPELINE_BUFFERS);
+  std::atomic<bool> b_abort(false);
+  std::exception_ptr err_read;
+  std::exception_ptr err_decode;
+  std::exception_ptr err_ltc;
+  std::thread decode_thread([&](){
+      try{
+        spsc_backoff_t backoff;
+        while( !b_abort ){
+          packet_slot_t* in(packets.read_slot());
+          if( !in ){
+            if( packets.finished() )
+              break;
+            backoff.wait();
+            continue;
+          }
+          backoff.reset();
+          AVPacket packet;
+          in->get( &packet );
+          if( decode_audio( &packet ) ){
+            sample_slot_t* out(NULL);
+            while( !(out = buffers.write_slot()) && !b_abort )
+              backoff.wait();
+            backoff.reset();
+            if( out ){
+              uint32_t n(pAudioFrame->nb_samples);
+              if( out->samples.size() < n*ltc_channel_count() )
+                out->samples.resize(n*ltc_channel_count());
+              convert_audio( &(out->samples[0]) );
+              out->n = n;
+              out->posinfo = ltc_posinfo;
+              ltc_posinfo += n;
+              buffers.push();
+            }
+          }
+          packets.pop();
+        }
+      }
+      catch( ... ){
+        err_decode = std::current_exception();
+        b_abort = true;
+      }
+      buffers.close();
+    });
+  std::thread ltc_thread([&](){
+      try{
+        spsc_backoff_t backoff;
+        while( !b_abort ){
+          sample_slot_t* in(buffers.read_slot());
+          if( !in ){
+            if( buffers.finished() )
+              break;
+            backoff.wait();
+            continue;
+          }
+          backoff.reset();
+          decode_ltc( &(in->samples[0]), in->n, in->posinfo );
+          buffers.pop();
+        }
+      }
+      catch( ... ){
+        err_ltc = std::current_exception();
+        b_abort = true;
+      }
+    });
+  try{
+    spsc_backoff_t backoff;
+    AVPacket packet;
+    av_init_packet( &packet );
+    while( !b_abort && (read_packet( &packet ) >= 0) ){
+      if( packet.stream_index == videoStream ){
+        if( !b_indexed )
+          process_video( &packet );
+      }else if( packet.stream_index == audioStream ){
+        packet_slot_t* slot(NULL);
+        while( !(slot = packets.write_slot()) && !b_abort )
+          backoff.wait();
+        backoff.reset();
+        if( slot ){
+          slot->assign( &packet );
+          packets.push();
+        }
+      }
+      av_free_packet( &packet );
+    }
+  }
+  catch( ... ){
+    err_read = std::current_exception();
+    b_abort = true;
+  }
+  packets.close();
+  decode_thread.join();
+  ltc_thread.join();
+  if( err_read )
+    std::rethrow_exception(err_read);
+  if( err_decode )
+    std::rethrow_exception(err_decode);
+  if( err_ltc )
+    std::rethrow_exception(err_ltc);
+}
+
+/**
+   Decode LTC in 'nchunks' parts of the audio stream in parallel.
+
+   Each chunk is decoded by a separate decoder with its own format
+   and codec context and LTC decoder, starting a few LTC frames before
+   the chunk and ending a few frames after it. Only the LTC frames
+   ending within the chunk are kept. The video frames are not read,
+   sort_frames() demuxes them (or takes them from the index, see
+   read_video_index()).
+
+   The chunk decoders take sample positions from the packet time
+   stamps, while scan_frame_map() counts the decoded samples. Both
+   agree only if every time stamp falls on a sample and the packets
+   follow each other without gaps; if any chunk finds otherwise
+   (see decode_audio_range()), the file is scanned serially instead.
+ */
+void decoder_t::scan_frame_map_parallel(uint32_t nchunks)
+{
+  select_index();
+  int64_t duration(audio_duration());
+  if( (nchunks < 2) || (duration <= 0) ){
+    while( readframe() );
+    return;
+  }
+  int64_t overlap(CHUNK_OVERLAP_FRAMES*frame_duration);
+  std::vector<ltc_timeline_t> parts(nchunks);
+  std::vector<std::vector<ltc_record_t> > recparts(nchunks);
+  std::vector<stats_t> statparts(nchunks);
+  std::vector<std::string> errors(nchunks);
+  std::vector<char> gapless(nchunks,false);
+  {
+    worker_pool_t pool(nchunks);
+    for(uint32_t k=0;k<nchunks;++k)
+      pool.add([&,k](){
+          int64_t start(duration*k/nchunks);
+          int64_t end(duration*(k+1)/nchunks);
+          bool b_last(k+1 == nchunks);
+          try{
+            std::ostringstream log;
+            decoder_t dec(fname,audiofps,decodeframes_,channel_,fstep,log,log);
+            dec.b_keep_records = b_keep_records;
+            dec.stats.b_enabled = stats.b_enabled;
+            dec.set_decimation(decimator.factor);
+            gapless[k] = dec.decode_audio_range(std::max(start-overlap,(int64_t)0),b_last?-1:end+overlap);
+            size_t first(dec.ltc_frame_ends.lower_bound(start));
+            size_t last(b_last?dec.ltc_frame_ends.size():dec.ltc_frame_ends.lower_bound(end));
+            parts[k].append(dec.ltc_frame_ends,first,last);
+            for(std::vector<ltc_record_t>::const_iterator r=dec.ltc_records.begin();r!=dec.ltc_records.end();++r)
+              if( (r->off_end >= start) && (b_last || (r->off_end < end)) )
+                recparts[k].push_back(*r);
+            statparts[k] = dec.stats;
+          }
+          catch( const std::exception& e ){
+            errors[k] = e.what();
+          }
+        });
+    pool.wait();
+  }
+  for(uint32_t k=0;k<nchunks;++k)
+    if( !errors[k].empty() )
+      throw error_msg_t(__FILE__,__LINE__,"Chunk %d: %s",k,errors[k].c_str());
+  if( std::find(gapless.begin(),gapless.end(),false) != gapless.end() ){
+    log_ << "Audio time stamps of \"" << fname << "\" are not sample exact or have gaps, scanning serially.\n";
+    while( readframe() );
+    return;
+  }
+  for(uint32_t k=0;k<nchunks;++k){
+    ltc_frame_ends.append(parts[k],0,parts[k].size());
+    ltc_records.insert(ltc_records.end(),recparts[k].begin(),recparts[k].end());
+    stats.add(statparts[k]);
+  }
+}
+
+/**
+   Preallocate the storage filled while reading packets, so that the
+   per-packet path does not allocate: the video frame positions and
+   LTC maps for the whole file, estimated from the stream durations,
+   or in streaming mode for the bounded window.
+ */
+void decoder_t::reserve_scan()
+{
+  size_t nframes(0);
+  if( frame_duration > 0 )
+    nframes = audio_duration()/frame_duration;
+  nframes = std::max((int64_t)nframes,pFormatCtx->streams[videoStream]->nb_frames)+SCAN_RESERVE_FRAMES;
+  // the streaming LTC map is compacted when half of it is discarded:
+  size_t nltc(b_streaming ? 2*(STREAM_MAX_PENDING+STREAM_REORDER_FRAMES) : nframes);
+  if( b_singlepass )
+    pending_frames.reserve(b_streaming ? 2*STREAM_MAX_PENDING : nframes);
+  if( !b_indexed && (!b_singlepass || b_keep_records) )
+    video_frame_ends.reserve(nframes);
+  ltc_frame_ends.reserve(nltc);
+  if( b_keep_records )
+    ltc_records.reserve(nframes);
+  for(std::vector<ltc_channel_t>::iterator it=ltc_channels.begin();it!=ltc_channels.end();++it){
+    it->frames.reserve(nltc);
+    if( b_keep_records )
+      it->records.reserve(nframes);
+  }
+}
+
+/**
+   Length of the audio stream in samples, or 0 if unknown.
+ */
+int64_t decoder_t::audio_duration() const
+{
+  AVStream* st(pFormatCtx->streams[audioStream]);
+  if( st->duration != AV_NOPTS_VALUE )
+    return av_rescale_q(st->duration,st->time_base,pCodecCtxAudio->time_base);
+  if( pFormatCtx->duration != AV_NOPTS_VALUE ){
+    AVRational tb_av = {1, AV_TIME_BASE};
+    return av_rescale_q(pFormatCtx->duration,tb_av,pCodecCtxAudio->time_base);
+  }
+  return 0;
+}
+
+/**
+   Find LTC discontinuities by decoding short audio windows only.
+
+   The offset between LTC and video frame number is measured every
+   'interval' seconds. Where two neighboring probes differ (or one of
+   them has no valid LTC), the interval is bisected until it is short,
+   and then decoded completely. The video frames are then resolved
+   against the sparse LTC timeline as in sort_frames(): in the gaps no
+   frame is resolved, which does not produce output as long as the
+   offset is unchanged, thus the reported sync changes are the same as
+   with a full decode. Two changes which cancel out between probes are
+   not found.
+ */
+void decoder_t::scan_probe(double interval)
+{
+  b_indexed = read_video_index();
+  if( !b_indexed )
+    read_video_frames();
+  probe_frames.clear();
+  probe_frames.reserve(video_frame_ends.size());
+  for(uint32_t k=0;k<video_frame_ends.size();++k)
+    probe_frames.push_back(std::make_pair(video_frame_ends[k],k));
+  std::sort(probe_frames.begin(),probe_frames.end());
+  int64_t duration(audio_duration());
+  if( duration <= 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unknown audio duration in file \"%s\", probing is not possible.",fname.c_str());
+  int64_t window(PROBE_WINDOW_FRAMES*(int64_t)frame_duration);
+  int64_t step(std::max((int64_t)(interval*sample_rate),2*window));
+  std::vector<probe_t> probes;
+  for(int64_t pos=0;pos+window<duration;pos+=step)
+    probes.push_back(probe(pos));
+  probes.push_back(probe(std::max(duration-window,(int64_t)0)));
+  for(uint32_t k=0;k+1<probes.size();++k)
+    if( !(probes[k].valid && probes[k+1].valid && (probes[k].offset == probes[k+1].offset)) )
+      bisect(probes[k],probes[k+1]);
+  sort_frames();
+}
+
+decoder_t::probe_t decoder_t::probe(int64_t pos)
+{
+  probe_t p;
+  int64_t window(PROBE_WINDOW_FRAMES*(int64_t)frame_duration);
+  p.pos = pos;
+  decode_audio_range(pos,pos+window,PROBE_WARMUP_FRAMES);
+  p.valid = probe_offset(pos,pos+window,p.offset);
+  return p;
+}
+
+void decoder_t::bisect(const probe_t& a, const probe_t& b)
+{
+  int64_t window(PROBE_WINDOW_FRAMES*(int64_t)frame_duration);
+  if( b.pos-a.pos <= 2*window ){
+    decode_audio_range(std::max(a.pos-window,(int64_t)0),b.pos+window,PROBE_WARMUP_FRAMES);
+    return;
+  }
+  probe_t m(probe((a.pos+b.pos)/2));
+  if( !(a.valid && m.valid && (a.offset == m.offset)) )
+    bisect(a,m);
+  if( !(m.valid && b.valid && (m.offset == b.offset)) )
+    bisect(m,b);
+}
+
+/**
+   Offset between LTC frame and input frame number of the first video
+   frame in the range 'from' to 'to' which can be resolved, using the
+   same criterion as process_video_sort().
+ */
+bool decoder_t::probe_offset(int64_t from, int64_t to, int64_t& offset) const
+{
+  std::vector<std::pair<int64_t,uint32_t> >::const_iterator it(std::lower_bound(probe_frames.begin(),probe_frames.end(),std::make_pair(from,(uint32_t)0)));
+  for(;(it != probe_frames.end()) && (it->first < to);++it){
+    if( it->second % fstep )
+      continue;
+    size_t lbound(ltc_frame_ends.lower_bound(it->first));
+    size_t ubound(ltc_frame_ends.upper_bound(it->first-frame_duration));
+    if( (lbound < ltc_frame_ends.size()) && (ubound < ltc_frame_ends.size()) &&
+        (ltc_frame_ends[lbound].frame == ltc_frame_ends[ubound].frame+1) ){
+      offset = (int64_t)ltc_frame_ends[lbound].frame - it->second/fstep;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+   Read the video frame positions without reading the audio stream,
+   in presentation order.
+ */
+void decoder_t::read_video_frames()
+{
+  for(uint32_t k=0;k<pFormatCtx->nb_streams;++k)
+    pFormatCtx->streams[k]->discard = ((int)k == videoStream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  AVPacket packet;
+  av_init_packet( &packet );
+  while( read_packet( &packet ) >= 0 ){
+    if( packet.stream_index == videoStream )
+      insert_frame( video_frame_ends, 0, pts2aframe( packet.pts ) );
+    av_free_packet( &packet );
+  }
+}
+
+/**
+   Decode LTC from the audio samples 'from' to 'to' (to<0: until the
+   end of the file).
+
+   The file is positioned at the audio packet before 'from', and all
+   other streams are discarded. Sample positions are taken from the
+   packet time stamps relative to the stream start. The first 'skip'
+   LTC frames are dropped unless decoding starts at the beginning.
+
+   Returns false if a time stamp does not fall on a sample, or a
+   packet does not start where the samples of the previous one ended;
+   the positions then differ from those counted by scan_frame_map().
+ */
+bool decoder_t::decode_audio_range(int64_t from, int64_t to, uint32_t skip)
+{
+  AVStream* st(pFormatCtx->streams[audioStream]);
+  for(uint32_t k=0;k<pFormatCtx->nb_streams;++k)
+    pFormatCtx->streams[k]->discard = ((int)k == audioStream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  ltc_skip = (from > 0) ? skip : 0;
+  int64_t start_time((st->start_time != AV_NOPTS_VALUE) ? st->start_time : 0);
+  av_seek_frame(pFormatCtx,audioStream,start_time+av_rescale_q(from,pCodecCtxAudio->time_base,st->time_base),AVSEEK_FLAG_BACKWARD);
+  avcodec_flush_buffers(pCodecCtxAudio);
+  // the LTC decoder must not see the discontinuity:
+  ltc_decoder_free(ltcdecoder);
+  ltcdecoder = ltc_decoder_create(ltc_apv/decimator.factor, LTC_QUEUE_LENGTH);
+  decimator.reset();
+  ltc_posinfo = from;
+  bool b_first(true);
+  bool b_gapless(true);
+  // a time stamp is on a sample if ts*num_st*den_a is divisible by den_st*num_a:
+  int64_t ts_num(st->time_base.num*(int64_t)pCodecCtxAudio->time_base.den);
+  int64_t ts_den(st->time_base.den*(int64_t)pCodecCtxAudio->time_base.num);
+  AVPacket packet;
+  av_init_packet( &packet );
+  while( ((to < 0) || (ltc_posinfo < to)) && (read_packet( &packet ) >= 0) ){
+    if( packet.stream_index == audioStream ){
+      if( packet.pts == AV_NOPTS_VALUE ){
+        b_gapless = false;
+      }else{
+        int64_t pos(av_rescale_q(packet.pts-start_time,st->time_base,pCodecCtxAudio->time_base));
+        if( ((packet.pts-start_time)*ts_num) % ts_den )
+          b_gapless = false;
+        if( b_first ){
+          ltc_posinfo = pos;
+          b_first = false;
+        }else if( pos != ltc_posinfo ){
+          b_gapless = false;
+        }
+      }
+      process_audio( &packet );
+    }
+    av_free_packet( &packet );
+  }
+  return b_gapless;
+}
+
+void decoder_t::select_index()
+{
+  if( b_audioonly ){
+    b_indexed = read_video_index();
+    if( !b_indexed )
+      log_ << "No complete video index in \"" << fname << "\", reading all packets.\n";
+  }
+}
+
+void decoder_t::sort_frames()
+{
+  if( !video_frame_ends.empty() ){
+    // merge-join of the video frame positions from the first pass
+    // (or the index) with the LTC timeline:
+    for(std::vector<int64_t>::const_iterator it=video_frame_ends.begin();it!=video_frame_ends.end();++it)
+      process_video_sort( *it );
+    return;
+  }
+  if( !pFormatCtx )
+    return;
+  // the first pass did not read the video frames (parallel chunks):
+  av_seek_frame(pFormatCtx,videoStream,0,AVSEEK_FLAG_FRAME);
+  read_video_frames();
+  for(std::vector<int64_t>::const_iterator it=video_frame_ends.begin();it!=video_frame_ends.end();++it)
+    process_video_sort( *it );
+}
+
+/**
+   Fill video_frame_ends from the index of the video stream and
+   discard all streams but the audio stream.
+
+   Only MOV/MP4 and Matroska containers are considered, and only if
+   the index lists every video frame (Matroska cues typically list
+   key frames only). Index time stamps are decoding time stamps; they
+   are shifted by the decoding delay of the first video packet. At a
+   constant frame rate, these are the presentation time stamps of the
+   frames in presentation order, as collected by process_video() and
+   read_video_frames(), thus '-a' numbers the frames in the same
+   order.
+
+   Returns false if no complete index is available.
+ */
+bool decoder_t::read_video_index()
+{
+  AVStream* st(pFormatCtx->streams[videoStream]);
+  std::string fmtname(pFormatCtx->iformat->name);
+  if( (fmtname.find("mov") == std::string::npos) && (fmtname.find("matroska") == std::string::npos) )
+    return false;
+  if( (st->nb_frames <= 0) || (st->nb_index_entries < st->nb_frames) )
+    return false;
+  int64_t delay(0);
+  AVPacket packet;
+  av_init_packet( &packet );
+  bool found(false);
+  while( !found && (read_packet( &packet ) >= 0) ){
+    if( packet.stream_index == videoStream ){
+      if( (packet.pts != AV_NOPTS_VALUE) && (packet.dts != AV_NOPTS_VALUE) )
+        delay = packet.pts - packet.dts;
+      found = true;
+    }
+    av_free_packet( &packet );
+  }
+  video_frame_ends.clear();
+  video_frame_ends.reserve( st->nb_index_entries );
+  for(int k=0;k<st->nb_index_entries;++k)
+    video_frame_ends.push_back( pts2aframe( st->index_entries[k].timestamp + delay ) );
+  for(uint32_t k=0;k<pFormatCtx->nb_streams;++k)
+    if( (int)k != audioStream )
+      pFormatCtx->streams[k]->discard = AVDISCARD_ALL;
+  av_seek_frame(pFormatCtx,videoStream,0,AVSEEK_FLAG_FRAME);
+  return true;
+}
+
+/**
+   Single-pass alternative to scan_frame_map() followed by sort_frames().
+
+   Video frames are kept in a small window until the LTC map covers
+   them, then they are resolved exactly as in sort_frames(). The file
+   is demuxed only once.
+ */
+void decoder_t::scan_and_sort()
+{
+  select_index();
+  if( b_indexed ){
+    // the video frames are known from the index, only audio is read:
+    while( readframe() );
+    sort_frames();
+    return;
+  }
+  b_singlepass = true;
+  reserve_scan();
+  while( readframe() )
+    resolve_pending(false);
+  resolve_pending(true);
+}
+
+/**
+   Single-pass alignment of non-seekable input (pipes, network
+   streams).
+
+   Memory does not grow with the stream length: only the video frames
+   waiting for LTC and the LTC frames needed to resolve them are
+   kept. Sync changes are written as soon as they are known.
+ */
+void decoder_t::scan_stream()
+{
+  b_singlepass = true;
+  b_streaming = true;
+  reserve_scan();
+  while( readframe() )
+    resolve_pending(false);
+  resolve_pending(true);
+}
+
+/**
+   Align a file which is still being written.
+
+   Like scan_stream(), but the demuxer and the LTC decoder keep their
+   state while the file grows, and only new packets are processed.
+   Sync changes are written as soon as they are known.
+
+   A packet is only read if the file extends at least FOLLOW_MARGIN
+   bytes beyond the read position, thus the demuxer never consumes a
+   partly written packet (which would be returned truncated, and the
+   remainder misparsed later). When the file size did not change for
+   'timeout' seconds, the recording is complete and the rest of the
+   file is read. Input of unknown size is read like a stream.
+
+   The container has to be readable while it grows, e.g. MPEG-TS or
+   fragmented MP4; a plain MP4 file has its index at the end.
+ */
+void decoder_t::scan_follow(double timeout)
+{
+  b_singlepass = true;
+  b_streaming = true;
+  reserve_scan();
+  int64_t size(avio_size(pFormatCtx->pb));
+  bool b_growing(size >= 0);
+  double idle(0);
+  while( true ){
+    while( (!b_growing || (avio_tell(pFormatCtx->pb)+FOLLOW_MARGIN <= size)) && readframe() )
+      resolve_pending(false);
+    if( !b_growing )
+      break;
+    out_.flush();
+    usleep(FOLLOW_POLL_INTERVAL);
+    int64_t newsize(avio_size(pFormatCtx->pb));
+    if( newsize != size ){
+      size = newsize;
+      idle = 0;
+    }else{
+      idle += 1e-6*FOLLOW_POLL_INTERVAL;
+      b_growing = (idle < timeout);
+    }
+  }
+  resolve_pending(true);
+}
+
+/**
+   Write each sync segment found by sort_frames() (or one of the
+   single-pass modes) to a separate file, without re-encoding.
+
+   The output files are named after the input file, with the LTC
+   frame number of the segment inserted before the extension. Video
+   and all audio streams are copied. Since packets are copied, a
+   segment starts at the first key frame at or after its cut
+   position, unless 'b_smartrender' is set; the time stamps of each
+   segment are shifted so that the cut position is at its LTC time.
+
+   With 'exportjobs' > 1, the segments are written in parallel, each
+   from a separate input context.
+ */
+void decoder_t::write_segments()
+{
+  if( !b_split || segments.empty() )
+    return;
+  if( !pFormatCtx )
+    throw error_msg_t(__FILE__,__LINE__,"Cannot split \"%s\": the input file is not open.",fname.c_str());
+  std::string stem;
+  std::string ext;
+  split_extension(fname,stem,ext);
+  for(std::vector<segment_t>::iterator it=segments.begin();it!=segments.end();++it){
+    char ctmp[32];
+    sprintf( ctmp, ".%05d", it->ltcframe );
+    it->filename = stem + ctmp + ext;
+  }
+  std::vector<int> streams(1,videoStream);
+  for(uint32_t k=0;k<pFormatCtx->nb_streams;++k){
+    AVStream* st(pFormatCtx->streams[k]);
+    if( ((int)k == videoStream) || (st->codec->codec_type == AVMEDIA_TYPE_AUDIO) ){
+      st->discard = AVDISCARD_DEFAULT;
+      if( (int)k != videoStream )
+        streams.push_back(k);
+    }else{
+      st->discard = AVDISCARD_ALL;
+    }
+  }
+  if( (exportjobs > 1) && (segments.size() > 1) ){
+    export_segments(fname,streams,pCodecCtxAudio->time_base,segments,b_smartrender,exportjobs,EXPORT_MAX_BUFFER);
+  }else{
+    av_seek_frame(pFormatCtx,videoStream,0,AVSEEK_FLAG_BACKWARD);
+    splitter_t split(pFormatCtx,streams,pCodecCtxAudio->time_base,segments,b_smartrender);
+    AVPacket packet;
+    av_init_packet( &packet );
+    while( read_packet( &packet ) >= 0 ){
+      split.add_packet( &packet );
+      av_free_packet( &packet );
+    }
+    split.flush();
+  }
+  for(std::vector<segment_t>::const_iterator it=segments.begin();it!=segments.end();++it)
+    log_ << "wrote " << it->filename << "\n";
+}
+
+/**
+   Write the video frames requested with '-d' as JPEG images.
+
+   For each frame the decoder seeks to the preceding key frame and
+   decodes up to the requested frame only; frames shortly after the
+   previous one are reached by decoding on. Frame numbers count video
+   frames in presentation order, from the first video frame.
+ */
+void decoder_t::extract_frames()
+{
+  if( decodeframes_.empty() )
+    return;
+  if( !pFormatCtx )
+    throw error_msg_t(__FILE__,__LINE__,"Cannot decode frames of \"%s\": the input file is not open.",fname.c_str());
+  AVStream* st(pFormatCtx->streams[videoStream]);
+  for(uint32_t k=0;k<pFormatCtx->nb_streams;++k)
+    pFormatCtx->streams[k]->discard = ((int)k == videoStream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  // frame positions in presentation order, if known:
+  std::vector<int64_t> positions(video_frame_ends);
+  std::sort(positions.begin(),positions.end());
+  int64_t t0(pts2aframe((st->start_time != AV_NOPTS_VALUE) ? st->start_time : 0));
+  std::string stem;
+  std::string ext;
+  split_extension(fname,stem,ext);
+  still_writer_t writer(STILL_THREADS);
+  // position of the last decoded frame, or -1 if a seek is required:
+  int64_t lastpos(-1);
+  bool b_eof(false);
+  for(std::set<uint32_t>::const_iterator it=decodeframes_.begin();it!=decodeframes_.end();++it){
+    int64_t target(0);
+    if( *it < positions.size() )
+      target = positions[*it];
+    else if( positions.empty() )
+      target = t0 + av_rescale(*it,(int64_t)fps_num*pCodecCtxAudio->time_base.den,(int64_t)fps_den*pCodecCtxAudio->time_base.num);
+    else{
+      log_ << "Warning: frame " << *it << " is beyond the end of the file.\n";
+      continue;
+    }
+    if( (lastpos < 0) || (target < lastpos) || (target-lastpos > STILL_SEEK_FRAMES*(int64_t)frame_duration) ){
+      av_seek_frame(pFormatCtx,videoStream,av_rescale_q(target,pCodecCtxAudio->time_base,st->time_base),AVSEEK_FLAG_BACKWARD);
+      avcodec_flush_buffers(pCodecCtxVideo);
+      b_eof = false;
+    }
+    bool found(false);
+    while( !found && decode_video_frame(b_eof) ){
+      int64_t ts(av_frame_get_best_effort_timestamp(pVideoFrame));
+      if( ts == AV_NOPTS_VALUE )
+        continue;
+      lastpos = pts2aframe(ts);
+      // accept the first frame less than half a frame before the target:
+      if( lastpos + frame_duration/2 >= target ){
+        char ctmp[32];
+        sprintf( ctmp, ".%06d.jpg", *it );
+        writer.add(pVideoFrame,stem+ctmp);
+        found = true;
+      }
+    }
+    if( !found )
+      log_ << "Warning: frame " << *it << " not found.\n";
+  }
+  writer.wait();
+}
+
+/**
+   Decode the next video frame into pVideoFrame. At the end of the
+   file, frames delayed by the decoder are returned. Returns false if
+   no more frames are available.
+ */
+bool decoder_t::decode_video_frame(bool& b_eof)
+{
+  while( true ){
+    AVPacket packet;
+    av_init_packet( &packet );
+    if( !b_eof && (read_packet( &packet ) < 0) )
+      b_eof = true;
+    if( b_eof ){
+      packet.data = NULL;
+      packet.size = 0;
+      packet.stream_index = videoStream;
+    }else if( packet.stream_index != videoStream ){
+      av_free_packet( &packet );
+      continue;
+    }
+    int got_frame(0);
+    avcodec_get_frame_defaults( pVideoFrame );
+    // errors of frames referring to frames before the seek point are ignored:
+    avcodec_decode_video2( pCodecCtxVideo, pVideoFrame, &got_frame, &packet );
+    if( !b_eof )
+      av_free_packet( &packet );
+    if( got_frame )
+      return true;
+    if( b_eof )
+      return false;
+  }
+}
+
+bool decoder_t::is_seekable() const
+{
+  return pFormatCtx && pFormatCtx->pb && pFormatCtx->pb->seekable;
+}
+
+/**
+   Decimate the audio by 'factor' (1, 2 or 4) before LTC decoding.
+
+   LTC is a signal of a few kHz, thus it can be decoded at a quarter
+   of typical audio sample rates, which reduces the time spent in
+   libltc. The LTC frame positions are mapped back to input samples;
+   they are accurate within 'factor' samples. Must be called before
+   decoding.
+ */
+void decoder_t::set_decimation(uint32_t factor)
+{
+  decimator = ltc_decimator_t(factor);
+  if( ltcdecoder ){
+    ltc_decoder_free(ltcdecoder);
+    ltcdecoder = ltc_decoder_create(ltc_apv/factor, LTC_QUEUE_LENGTH);
+  }
+}
+
+void decoder_t::resolve_pending(bool eof)
+{
+  // LTC frames are decoded in increasing order of 'off_end', thus the
+  // lookup of a video frame is final as soon as the map extends
+  // beyond its position. The newest 'reorder_depth' frames are kept,
+  // a later packet may still precede them in presentation order:
+  int64_t last(-1);
+  while( (pending_first < pending_frames.size()) &&
+         (eof || ((pending_frames.size()-pending_first > reorder_depth) &&
+                  ((!ltc_frame_ends.empty() && (ltc_frame_ends.back().off_end >= pending_frames[pending_first])) ||
+                   (pending_frames.size()-pending_first > STREAM_MAX_PENDING)))) ){
+    if( !eof && !b_pending_capped &&
+        (ltc_frame_ends.empty() || (ltc_frame_ends.back().off_end < pending_frames[pending_first])) ){
+      log_ << "More than " << STREAM_MAX_PENDING << " video frames without LTC in \"" << fname << "\", they remain unresolved.\n";
+      b_pending_capped = true;
+    }
+    last = pending_frames[pending_first];
+    process_video_sort( last );
+    last_resolved = last;
+    ++pending_first;
+  }
+  // reuse the storage, compacting when more than half is resolved:
+  if( pending_first == pending_frames.size() ){
+    pending_frames.clear();
+    pending_first = 0;
+  }else if( 2*pending_first > pending_frames.size() ){
+    pending_frames.erase(pending_frames.begin(),pending_frames.begin()+pending_first);
+    pending_first = 0;
+  }
+  if( b_streaming && (last >= 0) )
+    ltc_frame_ends.discard_before(last-(STREAM_REORDER_FRAMES+1)*(int64_t)frame_duration);
+}
+
+int64_t decoder_t::pts2aframe(int64_t pts) const
+{
+  return pts * 
+    pFormatCtx->streams[videoStream]->time_base.num * 
+    pCodecCtxAudio->time_base.den /
+    pFormatCtx->streams[videoStream]->time_base.den / 
+    pCodecCtxAudio->time_base.num;
+}
+
+void decoder_t::ff_compute_frame_duration(AVStream *st)
+{
+  if( st->codec->codec_type != AVMEDIA_TYPE_VIDEO )
+    return;
+  if (st->avg_frame_rate.num) {
+    fps_num = st->avg_frame_rate.den;
+    fps_den = st->avg_frame_rate.num;
+  } else if(st->time_base.num*1000LL > st->time_base.den) {
+    fps_num = st->time_base.num;
+    fps_den = st->time_base.den;
+  }else if(st->codec->time_base.num*1000LL > st->codec->time_base.den){
+    fps_num = st->codec->time_base.num;
+    fps_den = st->codec->time_base.den;
+    if (st->parser && st->parser->repeat_pict) {
+      if (fps_num > INT_MAX / (1 + st->parser->repeat_pict))
+        fps_den /= 1 + st->parser->repeat_pict;
+      else
+        fps_num *= 1 + st->parser->repeat_pict;
+    }
+    //If this codec can be interlaced or progressive then we need a parser to compute duration of a packet
+    //Thus if we have no parser in such case leave duration undefined.
+    if(st->codec->ticks_per_frame>1 && !st->parser){
+      fps_num = fps_den = 0;
+    }
+  }
+}
+
+AVCodecContext* decoder_t::open_decoder(AVCodecContext* pCodecCtxOrig)
+{
+  // Find the decoder for the video stream
+  AVCodec* pCodec( avcodec_find_decoder( pCodecCtxOrig->codec_id ) );
+  if( !pCodec )
+    throw error_msg_t(__FILE__,__LINE__,"Unsupported codec %d.", pCodecCtxOrig->codec_id);
+  // Copy context
+  AVCodecContext* pCodecCtx( avcodec_alloc_context3( pCodec ) );
+  if( avcodec_copy_context( pCodecCtx, pCodecCtxOrig ) != 0) 
+    throw error_msg_t(__FILE__,__LINE__,"Couldn't copy codec context.");
+  // Open codec
+  if( avcodec_open2( pCodecCtx, pCodec, NULL ) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Couldn't open codec for %s.",pCodec->long_name);
+  return pCodecCtx;
+}
+
+decoder_t::decoder_t(const std::string& filename, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t channel, uint32_t fstep_, std::ostream& out, std::ostream& log)
+  : fname(filename),
+    pFormatCtx(NULL),pCodecCtxVideo(NULL),pCodecCtxAudio(NULL),
+    b_own_input(true),
+    //pVideoFrame(av_frame_alloc()),
+    pVideoFrame(avcodec_alloc_frame()),
+    //pAudioFrame(av_frame_alloc()),
+    pAudioFrame(avcodec_alloc_frame()),
+    videoStream(-1),
+    audioStream(-1),
+    frameno(0),
+    lcursor(ltc_frame_ends),
+    ucursor(ltc_frame_ends),
+    ltc_skip(0),
+    pending_first(0),
+    reorder_depth(1),
+    last_resolved(-1),
+    b_pending_capped(false),
+    b_reorder_warned(false),
+    b_singlepass(false),
+    b_streaming(false),
+    b_indexed(false),
+    ltcdecoder(NULL),
+    fps_den(0),
+    fps_num(0),
+    frame_duration(0),
+    sample_rate(0),
+    ltc_posinfo(0),
+    ltc_apv(0),
+    samplebuffer(SAMPLEBUFFERSIZE),
+    current_frame(0),
+    current_inframe(0),
+    b_locked(false),
+    audiofps(audiofps_),
+  decodeframes_(decodeframes),
+  channel_(channel),
+  out_(out),
+  log_(log),
+  b_list(false),
+  b_audioonly(false),
+  b_keep_records(false),
+  b_split(false),
+  b_smartrender(false),
+  exportjobs(1),
+  b_pipeline(false),
+  b_framemap(false),
+  b_timeline(false),
+  fstep(fstep_),
+  fstepdec(0),
+  events(NULL)
+{
+  int averr(0);
+  if((averr = open_input(&pFormatCtx, filename)) < 0){
+    char averrs[1024];
+    av_strerror(averr,averrs,1024);
+    averrs[1023] = '\0';
+    throw error_msg_t(__FILE__,__LINE__,"Unable to open video file \"%s\" (%s).",filename.c_str(),averrs);
+
+  }
+  try{
+    // Retrieve stream information
+    if( avformat_find_stream_info( pFormatCtx, NULL) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Unable to retrieve stream information in video file \"%s\".",filename.c_str());
+    open_streams();
+  }
+  catch( ... ){
+    close_codecs();
+    close_input(&pFormatCtx);
+    throw;
+  }
+}
+
+/**
+   Create a decoder for packets demuxed by the caller, see
+   push_packet().
+
+   The format context 'ic' must be opened and its stream information
+   retrieved; it is not closed by the decoder. Sync changes are
+   reported as in scan_stream().
+ */
+decoder_t::decoder_t(AVFormatContext* ic, double audiofps_, uint32_t channel, std::ostream& out, std::ostream& log)
+  : fname(ic->filename),
+    pFormatCtx(ic),pCodecCtxVideo(NULL),pCodecCtxAudio(NULL),
+    b_own_input(false),
+    //pVideoFrame(av_frame_alloc()),
+    pVideoFrame(avcodec_alloc_frame()),
+    //pAudioFrame(av_frame_alloc()),
+    pAudioFrame(avcodec_alloc_frame()),
+    videoStream(-1),
+    audioStream(-1),
+    frameno(0),
+    lcursor(ltc_frame_ends),
+    ucursor(ltc_frame_ends),
+    ltc_skip(0),
+    pending_first(0),
+    reorder_depth(1),
+    last_resolved(-1),
+    b_pending_capped(false),
+    b_reorder_warned(false),
+    b_singlepass(true),
+    b_streaming(true),
+    b_indexed(false),
+    ltcdecoder(NULL),
+    fps_den(0),
+    fps_num(0),
+    frame_duration(0),
+    sample_rate(0),
+    ltc_posinfo(0),
+    ltc_apv(0),
+    samplebuffer(SAMPLEBUFFERSIZE),
+    current_frame(0),
+    current_inframe(0),
+    b_locked(false),
+    audiofps(audiofps_),
+  channel_(channel),
+  out_(out),
+  log_(log),
+  b_list(false),
+  b_audioonly(false),
+  b_keep_records(false),
+  b_split(false),
+  b_smartrender(false),
+  exportjobs(1),
+  b_pipeline(false),
+  b_framemap(false),
+  b_timeline(false),
+  fstep(1),
+  fstepdec(0),
+  events(NULL)
+{
+  try{
+    open_streams();
+  }
+  catch( ... ){
+    close_codecs();
+    throw;
+  }
+}
+
+/**
+   Find the video and audio streams and open their decoders and the
+   LTC decoder.
+ */
+void decoder_t::open_streams()
+{
+  // Find the first video stream:
+  for(uint32_t i=0; i<pFormatCtx->nb_streams; i++)
+    if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO) {
+      videoStream=i;
+      break;
+    }
+  // Find first audio stream:
+  for(uint32_t i=0; i<pFormatCtx->nb_streams; i++)
+    if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_AUDIO) {
+      audioStream=i;
+      break;
+    }
+  if(videoStream==-1)
+    throw error_msg_t(__FILE__,__LINE__,"No video stream found in file \"%s\".",fname.c_str());
+  if(audioStream==-1)
+    throw error_msg_t(__FILE__,__LINE__,"No audio stream found in file \"%s\".",fname.c_str());
+  pCodecCtxVideo = open_decoder( pFormatCtx->streams[videoStream]->codec );
+  reorder_depth = pCodecCtxVideo->has_b_frames+1;
+  pCodecCtxAudio = open_decoder( pFormatCtx->streams[audioStream]->codec );
+  ff_compute_frame_duration(pFormatCtx->streams[videoStream]);
+  if( !fps_num )
+    throw error_msg_t(__FILE__,__LINE__,"Invalid frame rate (0).");
+  if( !b_list ){
+    log_ << "fps: " << fps_den << "/" << fps_num << "\n";
+  }
+  frame_duration = fps_num*pCodecCtxAudio->time_base.den/fps_den/pCodecCtxAudio->time_base.num;
+  sample_rate = pCodecCtxAudio->sample_rate;
+  video_time_base = pFormatCtx->streams[videoStream]->time_base;
+  audio_time_base = pCodecCtxAudio->time_base;
+  avcodec_default_get_buffer(pCodecCtxAudio, pAudioFrame );
+  ltc_apv = pCodecCtxAudio->sample_rate * pCodecCtxVideo->time_base.den / std::max(pCodecCtxVideo->time_base.num,1);
+  ltcdecoder = ltc_decoder_create(ltc_apv, LTC_QUEUE_LENGTH);
+}
+
+void decoder_t::close_codecs()
+{
+  free_ltc_channels();
+  if( ltcdecoder )
+    ltc_decoder_free(ltcdecoder);
+  ltcdecoder = NULL;
+  if( pCodecCtxVideo ){
+    avcodec_close(pCodecCtxVideo);
+    av_free(pCodecCtxVideo);
+  }
+  pCodecCtxVideo = NULL;
+  if( pCodecCtxAudio ){
+    avcodec_close(pCodecCtxAudio);
+    av_free(pCodecCtxAudio);
+  }
+  pCodecCtxAudio = NULL;
+  avcodec_free_frame(&pVideoFrame);
+  avcodec_free_frame(&pAudioFrame);
+}
+
+/**
+   Create a decoder from a cached LTC map, without opening the file.
+
+   Only sort_frames() is meaningful for such a decoder. LTC frame
+   numbers are computed from the cached time codes with the current
+   frame rate settings.
+ */
+decoder_t::decoder_t(const ltc_cache_t& cache, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t fstep_, std::ostream& out, std::ostream& log)
+  : fname(cache.id.path),
+    pFormatCtx(NULL),pCodecCtxVideo(NULL),pCodecCtxAudio(NULL),
+    b_own_input(true),
+    pVideoFrame(NULL),
+    pAudioFrame(NULL),
+    videoStream(-1),
+    audioStream(-1),
+    frameno(0),
+    video_frame_ends(cache.video_frame_ends),
+    lcursor(ltc_frame_ends),
+    ucursor(ltc_frame_ends),
+    ltc_skip(0),
+    pending_first(0),
+    reorder_depth(1),
+    last_resolved(-1),
+    b_pending_capped(false),
+    b_reorder_warned(false),
+    b_singlepass(false),
+    b_streaming(false),
+    b_indexed(true),
+    ltcdecoder(NULL),
+    fps_den(cache.fps_den),
+    fps_num(cache.fps_num),
+    frame_duration(cache.frame_duration),
+    sample_rate(cache.sample_rate),
+    ltc_posinfo(0),
+    ltc_apv(0),
+    current_frame(0),
+    current_inframe(0),
+    b_locked(false),
+    audiofps(audiofps_),
+  decodeframes_(decodeframes),
+  channel_(cache.channel),
+  out_(out),
+  log_(log),
+  b_list(false),
+  b_audioonly(false),
+  b_keep_records(false),
+  b_split(false),
+  b_smartrender(false),
+  exportjobs(1),
+  b_pipeline(false),
+  b_framemap(false),
+  b_timeline(false),
+  fstep(fstep_),
+  fstepdec(0),
+  events(NULL)
+{
+  video_time_base = cache.video_time_base;
+  audio_time_base = cache.audio_time_base;
+  ltc_frame_ends.reserve(cache.records.size());
+  for(std::vector<ltc_record_t>::const_iterator r=cache.records.begin();r!=cache.records.end();++r)
+    ltc_frame_ends.add(r->off_end,ltc_frame_number(r->tc));
+}
+
+/**
+   Store the LTC map and the stream parameters in a cache object.
+
+   Requires 'b_keep_records' to be set before decoding.
+ */
+void decoder_t::get_cache(ltc_cache_t& cache) const
+{
+  cache.channel = channel_;
+  cache.fps_num = fps_num;
+  cache.fps_den = fps_den;
+  if( pFormatCtx ){
+    cache.video_time_base = pFormatCtx->streams[videoStream]->time_base;
+    cache.audio_time_base = pCodecCtxAudio->time_base;
+  }
+  cache.sample_rate = sample_rate;
+  cache.frame_duration = frame_duration;
+  cache.video_frame_ends = video_frame_ends;
+  cache.records = ltc_records;
+}
+
+/**
+   Sync segments found by sort_frames() as clips on the LTC timeline,
+   requires 'b_timeline' to be set before sorting. Each clip ends at
+   the start of the next one, or at the last video frame.
+ */
+void decoder_t::get_clips(std::vector<clip_t>& clips) const
+{
+  uint32_t nframes(current_inframe*fstep);
+  for(size_t k=0;k<segments.size();++k){
+    clip_t clip;
+    clip.filename = fname;
+    clip.inframe = segments[k].inframe;
+    clip.ltcframe = segments[k].ltcframe;
+    uint32_t end((k+1 < segments.size()) ? segments[k+1].inframe : nframes);
+    clip.nframes = (end > clip.inframe) ? end-clip.inframe : 0;
+    clips.push_back(clip);
+  }
+}
+
+/**
+   Write the frame map collected by sort_frames(), requires
+   'b_framemap' to be set before sorting.
+ */
+void decoder_t::write_framemap(const std::string& filename)
+{
+  framemap.header.fstep = fstep;
+  framemap.header.fps_num = fps_num;
+  framemap.header.fps_den = fps_den;
+  framemap.header.video_time_base_num = video_time_base.num;
+  framemap.header.video_time_base_den = video_time_base.den;
+  framemap.header.audio_time_base_num = audio_time_base.num;
+  framemap.header.audio_time_base_den = audio_time_base.den;
+  framemap.header.sample_rate = sample_rate;
+  framemap.save(filename);
+}
+
+decoder_t::~decoder_t()
+{
+  close_codecs();
+  if( pFormatCtx && b_own_input )
+    close_input(&pFormatCtx);
+}
+
+/**
+   av_read_frame() with statistics.
+ */
+int decoder_t::read_packet(AVPacket* packet)
+{
+  int err(0);
+  {
+    stage_timer_t timer(stats,stats_t::READ);
+    err = av_read_frame( pFormatCtx, packet );
+  }
+  if( stats.b_enabled && (err >= 0) ){
+    stats_t::stream_t st(stats_t::OTHER);
+    if( packet->stream_index == videoStream )
+      st = stats_t::VIDEO;
+    else if( packet->stream_index == audioStream )
+      st = stats_t::AUDIO;
+    ++stats.packets[st];
+    stats.bytes[st] += packet->size;
+  }
+  return err;
+}
+
+bool decoder_t::readframe()
+{
+  AVPacket packet;
+  av_init_packet( &packet );
+  if( read_packet( &packet ) >= 0 ){
+    process_packet( &packet );
+    av_free_packet( &packet );
+    return true;
+  }
+  return false;
+}
+
+void decoder_t::process_packet(AVPacket* packet)
+{
+  if( packet->stream_index == videoStream ){
+    if( !b_indexed )
+      process_video( packet );
+  }else if( packet->stream_index == audioStream ) {
+    process_audio( packet );
+  }
+}
+
+/**
+   Process one packet demuxed by the caller; the packet is not freed.
+   Sync changes are reported as soon as they are known.
+ */
+void decoder_t::push_packet(AVPacket* packet)
+{
+  process_packet( packet );
+  resolve_pending(false);
+}
+
+/**
+   Report the remaining sync changes after the last push_packet().
+ */
+void decoder_t::finish()
+{
+  resolve_pending(true);
+}
+
+void decoder_t::process_video(AVPacket* packet)
+{
+  if( b_singlepass ){
+    int64_t aframe(pts2aframe( packet->pts ));
+    size_t moved(insert_frame( pending_frames, pending_first, aframe ));
+    if( moved >= reorder_depth )
+      reorder_depth = moved+1;
+    if( (last_resolved > aframe) && !b_reorder_warned ){
+      log_ << "Video frames of \"" << fname << "\" are reordered by more than " << reorder_depth-1 << " frames, frame numbers may be off.\n";
+      b_reorder_warned = true;
+    }
+  }
+  if( !b_singlepass || b_keep_records )
+    insert_frame( video_frame_ends, 0, pts2aframe( packet->pts ) );
+  //DEBUG(video_frame_ends.back());
+}
+
+void decoder_t::process_video_sort(int64_t aframe)
+{
+  if( fstepdec )
+    fstepdec--;
+  if( !fstepdec ){
+    fstepdec = fstep;
+    size_t lbound(0);
+    size_t ubound(0);
+    {
+      stage_timer_t timer(stats,stats_t::LOOKUP);
+      lbound = lcursor.lower_bound(aframe);
+      ubound = ucursor.upper_bound(aframe-frame_duration);
+    }
+    ++stats.video_frames;
+    bool b_valid( (lbound < ltc_frame_ends.size()) && (ubound < ltc_frame_ends.size()) &&
+                  (ltc_frame_ends[lbound].frame == ltc_frame_ends[ubound].frame+1) );
+    if( b_valid ){
+      if( current_frame != ltc_frame_ends[lbound].frame ){
+        current_frame = ltc_frame_ends[lbound].frame;
+        if( b_split || b_timeline ){
+          segment_t seg;
+          seg.inframe = current_inframe*fstep;
+          seg.ltcframe = current_frame*fstep;
+          seg.start = aframe;
+          seg.ltctime = (double)seg.ltcframe*fps_num/fps_den;
+          segments.push_back(seg);
+        }
+        int delta_frame((int)current_frame - (int)current_inframe);
+        delta_frame *= fstep;
+        if( events )
+          events->sync_change(current_inframe*fstep,current_frame*fstep,delta_frame,aframe-ltc_frame_ends[lbound].off_end);
+        int delta_frame_abs(abs(delta_frame));
+        int delta_sec(delta_frame_abs*fps_num/fps_den);
+        char stime[32];
+        memset(stime,0,32);
+        sprintf( stime, "%c%02d:%02d:%02d.%02d %1.4fs/%d samples",(delta_frame<0)?'-':'+',delta_sec/3600,(delta_sec/60)%60,delta_sec%60,(delta_frame_abs*fps_num)%fps_den, (double)((int)aframe-(int)(ltc_frame_ends[lbound].off_end))/sample_rate, (int)aframe-(int)(ltc_frame_ends[lbound].off_end) );
+        if( b_list ){
+          out_ << current_inframe*fstep << " " << current_frame*fstep << " " << delta_frame << "\n";
+        }else{
+          out_ << current_inframe*fstep << " -> " << current_frame*fstep << " (" << 
+            delta_frame << " " << stime << ")\n";
+        }
+        if( b_streaming )
+          out_.flush();
+      }
+      b_locked = true;
+    }
+    if( b_framemap ){
+      framemap_entry_t e;
+      e.ltcframe = current_frame*fstep;
+      e.offset = b_valid ? (int32_t)(aframe-ltc_frame_ends[lbound].off_end) : 0;
+      e.flags = b_valid ? FRAMEMAP_VALID : (b_locked ? FRAMEMAP_EXTRAPOLATED : 0);
+      framemap.set(current_inframe*fstep,e);
+      // the frames skipped with fstep > 1 are counted on, the map is
+      // dense:
+      framemap_entry_t skipped(e);
+      skipped.offset = 0;
+      if( skipped.flags )
+        skipped.flags = FRAMEMAP_EXTRAPOLATED;
+      for(uint32_t k=1;k<fstep;++k){
+        ++skipped.ltcframe;
+        framemap.set(current_inframe*fstep+k,skipped);
+      }
+    }
+    current_frame++;
+    current_inframe++;
+  }
+}
+
+uint32_t decoder_t::ltc_frame_number(const SMPTETimecode& stime) const
+{
+  uint64_t fno(stime.frame+fps_den*(stime.secs+stime.mins*60+stime.hours*3600)/(fps_num*fstep));
+  if( audiofps > 0 )
+    fno = stime.frame*fps_den/(audiofps*fps_num)+fps_den*(stime.secs+stime.mins*60+stime.hours*3600)/(fps_num*fstep);
+  return fno;
+}
+
+void decoder_t::process_audio(AVPacket* packet)
+{
+  // first, decode audio frame from video:
+  if( decode_audio( packet ) ){
+    // now decode LTC from audio:
+    size_t n(pAudioFrame->nb_samples*ltc_channel_count());
+    // grows only for an unusually long first frame:
+    if( samplebuffer.size() < n )
+      samplebuffer.resize(n);
+    convert_audio( &(samplebuffer[0]) );
+    decode_ltc( &(samplebuffer[0]), pAudioFrame->nb_samples, ltc_posinfo );
+    ltc_posinfo += pAudioFrame->nb_samples;
+  }
+}
+
+/**
+   Decode one audio packet into pAudioFrame. Returns true if a frame
+   was decoded.
+ */
+bool decoder_t::decode_audio(AVPacket* packet)
+{
+  int got_frame(0);
+  int len(0);
+  {
+    stage_timer_t timer(stats,stats_t::DECODE_AUDIO);
+    len = avcodec_decode_audio4(pCodecCtxAudio, pAudioFrame, &got_frame, packet);
+  }
+  if( len < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Error while decoding audio in \"%s\".",fname.c_str());
+  return got_frame;
+}
+
+/**
+   Number of channels decoded for LTC: one, or all audio channels
+   after decode_all_channels().
+ */
+uint32_t decoder_t::ltc_channel_count() const
+{
+  return ltc_channels.empty() ? 1 : ltc_channels.size();
+}
+
+/**
+   Convert the LTC channel of pAudioFrame into 'ltcsamples' (at least
+   pAudioFrame->nb_samples samples). In all-channel mode, all channels
+   are converted, one after the other (ltc_channel_count() times
+   pAudioFrame->nb_samples samples).
+ */
+void decoder_t::convert_audio(ltcsnd_sample_t* ltcsamples)
+{
+  uint32_t n(pAudioFrame->nb_samples);
+  {
+    stage_timer_t timer(stats,stats_t::CONVERT);
+    if( ltc_channels.empty() )
+      convert_audio_samples(ltcsamples, pAudioFrame->data, n, pCodecCtxAudio->channels, pCodecCtxAudio->sample_fmt,channel_);
+    else
+      for(uint32_t c=0;c<ltc_channels.size();++c)
+        convert_audio_samples(ltcsamples+c*n, pAudioFrame->data, n, pCodecCtxAudio->channels, pCodecCtxAudio->sample_fmt,c);
+  }
+  stats.samples_converted += n*ltc_channel_count();
+}
+
+/**
+   Pass 'n' samples (per channel) starting at audio sample 'posinfo'
+   to the LTC decoder, and add the completed LTC frames to the map.
+   In all-channel mode, each channel is passed to its own decoder.
+ */
+void decoder_t::decode_ltc(ltcsnd_sample_t* ltcsamples, uint32_t n, int64_t posinfo)
+{
+  if( ltc_channels.empty() ){
+    decode_ltc_channel(ltcdecoder, decimator, ltc_frame_ends, ltc_records, ltc_skip, ltcsamples, n, posinfo);
+    return;
+  }
+  for(uint32_t c=0;c<ltc_channels.size();++c){
+    ltc_channel_t& ch(ltc_channels[c]);
+    decode_ltc_channel(ch.decoder, ch.decimator, ch.frames, ch.records, ch.skip, ltcsamples+c*n, n, posinfo);
+  }
+}
+
+void decoder_t::decode_ltc_channel(LTCDecoder* dec, ltc_decimator_t& decim, ltc_timeline_t& frames, std::vector<ltc_record_t>& records, uint32_t& skip, ltcsnd_sample_t* ltcsamples, uint32_t n, int64_t posinfo)
+{
+  if( decim.factor > 1 ){
+    stage_timer_t timer(stats,stats_t::DECIMATE);
+    n = decim.process(ltcsamples, n, posinfo, posinfo);
+  }
+  {
+    stage_timer_t timer(stats,stats_t::LTC_WRITE);
+    ltc_decoder_write(dec, ltcsamples, n, posinfo);
+  }
+  stage_timer_t timer(stats,stats_t::LTC_READ);
+  LTCFrameExt ltcframe;
+  while (ltc_decoder_read(dec,&ltcframe)) {
+    SMPTETimecode stime;
+    ltc_frame_to_time(&stime, &ltcframe.ltc, false );
+    ++stats.ltc_frames;
+    if( skip ){
+      --skip;
+      ++stats.ltc_dropped;
+      continue;
+    }
+    if( decim.factor > 1 ){
+      // back to input sample positions, at the end of the decimated sample:
+      ltcframe.off_start = decim.position(ltcframe.off_start);
+      ltcframe.off_end = decim.position(ltcframe.off_end+1)-1;
+    }
+    // 'ltcframe.off_end' is the audio sample number of the LTC frame end.
+    uint32_t fno(ltc_frame_number(stime));
+    frames.add(ltcframe.off_end,fno);
+    if( events ){
+      ltc_record_t rec;
+      rec.off_start = ltcframe.off_start;
+      rec.off_end = ltcframe.off_end;
+      rec.tc = stime;
+      events->ltc_frame(rec,fno);
+    }
+    if( b_keep_records ){
+      ltc_record_t rec;
+      rec.off_start = ltcframe.off_start;
+      rec.off_end = ltcframe.off_end;
+      rec.tc = stime;
+      records.push_back(rec);
+    }
+  }
+}
+
+/**
+   Decode LTC from all audio channels in the next scan, each with its
+   own LTC decoder and map. Call select_channel() or
+   sort_all_channels() after the scan. Must be called after
+   set_decimation().
+ */
+void decoder_t::decode_all_channels()
+{
+  free_ltc_channels();
+  ltc_channels.resize(std::max(pCodecCtxAudio->channels,1));
+  for(uint32_t c=0;c<ltc_channels.size();++c){
+    ltc_channels[c].decoder = ltc_decoder_create(ltc_apv/decimator.factor, LTC_QUEUE_LENGTH);
+    ltc_channels[c].decimator = ltc_decimator_t(decimator.factor);
+  }
+}
+
+/**
+   Number of LTC frames in 'frames' which directly follow their
+   predecessor in time code, i.e. valid and monotonic frames.
+ */
+static uint32_t count_valid_frames(const ltc_timeline_t& frames)
+{
+  uint32_t n(0);
+  for(size_t k=frames.begin()+1;k<frames.size();++k)
+    if( frames[k].frame == frames[k-1].frame+1 )
+      ++n;
+  return n;
+}
+
+/**
+   Use the channel with the most valid, monotonic LTC frames after an
+   all-channel scan, and continue as if only this channel had been
+   decoded.
+ */
+void decoder_t::select_channel()
+{
+  if( ltc_channels.empty() )
+    return;
+  uint32_t best(0);
+  uint32_t nbest(0);
+  for(uint32_t c=0;c<ltc_channels.size();++c){
+    uint32_t n(count_valid_frames(ltc_channels[c].frames));
+    if( !b_list )
+      log_ << "channel " << c << ": " << n << " valid LTC frames\n";
+    if( n > nbest ){
+      best = c;
+      nbest = n;
+    }
+  }
+  if( !nbest )
+    log_ << "Warning: no valid LTC found in any channel of \"" << fname << "\".\n";
+  log_ << "LTC channel: " << best << "\n";
+  channel_ = best;
+  ltc_frame_ends = ltc_channels[best].frames;
+  ltc_records.swap(ltc_channels[best].records);
+  free_ltc_channels();
+}
+
+/**
+   Report the sync changes of every channel with LTC after an
+   all-channel scan. The output of each channel is preceded by a line
+   "# channel <n>".
+ */
+void decoder_t::sort_all_channels()
+{
+  for(uint32_t c=0;c<ltc_channels.size();++c){
+    if( ltc_channels[c].frames.empty() ){
+      if( !b_list )
+        log_ << "channel " << c << ": no LTC\n";
+      continue;
+    }
+    out_ << "# channel " << c << "\n";
+    ltc_frame_ends = ltc_channels[c].frames;
+    lcursor.reset();
+    ucursor.reset();
+    current_frame = 0;
+    current_inframe = 0;
+    fstepdec = 0;
+    b_locked = false;
+    sort_frames();
+  }
+  free_ltc_channels();
+}
+
+void decoder_t::free_ltc_channels()
+{
+  for(std::vector<ltc_channel_t>::iterator it=ltc_channels.begin();it!=ltc_channels.end();++it)
+    if( it->decoder )
+      ltc_decoder_free(it->decoder);
+  ltc_channels.clear();
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,241 @@
+/*
+  decoder - LTC decoding and alignment of video files
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <set>
+#include <ltc.h>
+#include "ltctimeline.h"
+#include "ltccache.h"
+#include "splitter.h"
+#include "stats.h"
+#include "audioconv.h"
+#include "framemap.h"
+#include "timeline.h"
+
+extern "C" {
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+}
+
+/**
+   Receiver of the results of a decoder, see decoder_t::events.
+ */
+class decoder_events_t {
+public:
+  virtual ~decoder_events_t() {};
+  /**
+     Change of the offset between input frame and LTC frame.
+
+     @param inframe Input video frame number
+     @param ltcframe LTC frame number of this video frame
+     @param delta Difference of LTC and input frame number
+     @param offset Position of the video frame relative to the end of the LTC frame, in audio samples
+   */
+  virtual void sync_change(uint32_t inframe, uint32_t ltcframe, int32_t delta, int64_t offset) {};
+  /**
+     Decoded LTC frame; in pipelined mode (b_pipeline), this is called
+     from the LTC decoding thread.
+   */
+  virtual void ltc_frame(const ltc_record_t& rec, uint32_t frame) {};
+};
+
+/**
+   LTC decoder and video frame alignment of one video file.
+ */
+class decoder_t 
+{
+public:
+  decoder_t(const std::string& filename, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t channel, uint32_t fstep_, std::ostream& out = std::cout, std::ostream& log = std::cerr);
+  decoder_t(const ltc_cache_t& cache, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t fstep_, std::ostream& out = std::cout, std::ostream& log = std::cerr);
+  decoder_t(AVFormatContext* ic, double audiofps_, uint32_t channel, std::ostream& out = std::cout, std::ostream& log = std::cerr);
+  ~decoder_t();
+  void get_cache(ltc_cache_t& cache) const;
+  void write_framemap(const std::string& filename);
+  void get_clips(std::vector<clip_t>& clips) const;
+  void scan_frame_map();
+  void sort_frames();
+  void scan_and_sort();
+  void scan_stream();
+  void scan_follow(double timeout);
+  bool is_seekable() const;
+  void set_decimation(uint32_t factor);
+  void decode_all_channels();
+  void select_channel();
+  void sort_all_channels();
+  void scan_frame_map_parallel(uint32_t nchunks);
+  void scan_probe(double interval);
+  void write_segments();
+  void extract_frames();
+  void push_packet(AVPacket* packet);
+  void finish();
+private:
+  class probe_t {
+  public:
+    int64_t pos;
+    bool valid;
+    int64_t offset;
+  };
+  /**
+     LTC decoder and map of one audio channel, all-channel mode only.
+   */
+  class ltc_channel_t {
+  public:
+    ltc_channel_t() : decoder(NULL), skip(0) {};
+    LTCDecoder* decoder;
+    ltc_decimator_t decimator;
+    ltc_timeline_t frames;
+    std::vector<ltc_record_t> records;
+    uint32_t skip;
+  };
+  probe_t probe(int64_t pos);
+  void bisect(const probe_t& a, const probe_t& b);
+  bool probe_offset(int64_t from, int64_t to, int64_t& offset) const;
+  void read_video_frames();
+  bool decode_video_frame(bool& b_eof);
+  int64_t audio_duration() const;
+  bool decode_audio_range(int64_t from, int64_t to, uint32_t skip = 0);
+  int read_packet(AVPacket* packet);
+  bool readframe();
+  void process_packet(AVPacket* packet);
+  void open_streams();
+  void process_video(AVPacket* packet);
+  void process_audio(AVPacket* packet);
+  bool decode_audio(AVPacket* packet);
+  void convert_audio(ltcsnd_sample_t* ltcsamples);
+  void decode_ltc(ltcsnd_sample_t* ltcsamples, uint32_t n, int64_t posinfo);
+  void decode_ltc_channel(LTCDecoder* dec, ltc_decimator_t& decim, ltc_timeline_t& frames, std::vector<ltc_record_t>& records, uint32_t& skip, ltcsnd_sample_t* ltcsamples, uint32_t n, int64_t posinfo);
+  uint32_t ltc_channel_count() const;
+  void free_ltc_channels();
+  void read_pipelined();
+  void process_video_sort(int64_t aframe);
+  void resolve_pending(bool eof);
+  bool read_video_index();
+  void select_index();
+  int64_t pts2aframe(int64_t pts) const;
+  uint32_t ltc_frame_number(const SMPTETimecode& stime) const;
+  AVCodecContext* open_decoder(AVCodecContext*);
+  void close_codecs();
+  void ff_compute_frame_duration(AVStream *st);
+  void reserve_scan();
+  std::string fname;
+  AVFormatContext* pFormatCtx;
+  AVCodecContext* pCodecCtxVideo;
+  AVCodecContext* pCodecCtxAudio;
+  // pFormatCtx is closed by the decoder:
+  bool b_own_input;
+  AVFrame *pVideoFrame;
+  AVFrame *pAudioFrame;
+  int videoStream;
+  int audioStream;
+  uint32_t frameno;
+  // list of PTS in audio samples, from video codec:
+  std::vector<int64_t> video_frame_ends;
+  // map of LTC frame numbers as function of audio samples:
+  ltc_timeline_t ltc_frame_ends;
+  // merge-join lookup of video frames in ltc_frame_ends:
+  ltc_cursor_t lcursor;
+  ltc_cursor_t ucursor;
+  // probe mode: video frames sorted by position, with packet index:
+  std::vector<std::pair<int64_t,uint32_t> > probe_frames;
+  // LTC frames to be dropped after a seek:
+  uint32_t ltc_skip;
+  // raw decoded LTC frames, kept only for the cache:
+  std::vector<ltc_record_t> ltc_records;
+  // video frames (in audio samples) waiting for LTC, single-pass mode
+  // only; the frames before 'pending_first' are resolved:
+  std::vector<int64_t> pending_frames;
+  size_t pending_first;
+  // newest pending frames which are not resolved yet, since a later
+  // packet may precede them (B-frames + 1, grows if exceeded):
+  size_t reorder_depth;
+  int64_t last_resolved;
+  // the pending window was capped, or a frame came too late (logged once):
+  bool b_pending_capped;
+  bool b_reorder_warned;
+  // sync segments, collected only if 'b_split' or 'b_timeline' is set:
+  std::vector<segment_t> segments;
+  bool b_singlepass;
+  // streaming mode: bounded memory, no seeking, incremental output:
+  bool b_streaming;
+  // video frame positions were taken from the container index:
+  bool b_indexed;
+  LTCDecoder *ltcdecoder;
+  // optional decimation of the samples passed to 'ltcdecoder':
+  ltc_decimator_t decimator;
+  // all-channel mode: one LTC decoder per audio channel:
+  std::vector<ltc_channel_t> ltc_channels;
+  int fps_den;
+  int fps_num;
+  uint32_t frame_duration;
+  int sample_rate;
+  AVRational video_time_base;
+  AVRational audio_time_base;
+  int64_t ltc_posinfo;
+  int ltc_apv;
+  // converted LTC samples of one audio frame:
+  std::vector<ltcsnd_sample_t> samplebuffer;
+  uint32_t current_frame;
+  uint32_t current_inframe;
+  // at least one video frame was resolved:
+  bool b_locked;
+  // frame map, collected only if 'b_framemap' is set:
+  framemap_writer_t framemap;
+  double audiofps;
+  std::set<uint32_t> decodeframes_;
+  uint32_t channel_;
+  std::ostream& out_;
+  std::ostream& log_;
+public:
+  bool b_list;
+  bool b_audioonly;
+  bool b_keep_records;
+  // counters and timers, enabled with stats.b_enabled:
+  stats_t stats;
+  bool b_split;
+  // re-encode the frames between each cut and the next key frame:
+  bool b_smartrender;
+  // number of segments written in parallel:
+  uint32_t exportjobs;
+  // first pass in three threads (demux, audio decode, LTC decode):
+  bool b_pipeline;
+  // collect a frame map in sort_frames(), see write_framemap():
+  bool b_framemap;
+  // collect sync segments for get_clips():
+  bool b_timeline;
+  uint32_t fstep;
+  // step decrement variable:
+  uint32_t fstepdec;
+  // receiver of sync changes and LTC frames, or NULL:
+  decoder_events_t* events;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,625 @@
+/*
+  decoder_bench - throughput and correctness of LTC decoding on generated files
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "decoder.h"
+#include "mmapio.h"
+#include "framemap.h"
+#include "ltcgen.h"
+#include "error.h"
+
+// default duration of the test files in seconds:
+#define DURATION 120
+// number of LTC jumps per file:
+#define NJUMPS 4
+// LTC frame number of the first frame, 10:00:00:00 at 25 fps:
+#define START_FRAME 900000
+// LTC frames decoded before the steady-state allocation count starts:
+#define WARMUP_FRAMES 250
+
+// allocations with operator new, for the steady-state check:
+static std::atomic<uint64_t> nallocs(0);
+
+void* operator new(size_t size)
+{
+  ++nallocs;
+  void* p(malloc(size ? size : 1));
+  if( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+class bench_case_t {
+public:
+  AVSampleFormat fmt;
+  uint32_t channels;
+  uint32_t fps;
+};
+
+/**
+   Compare the sync changes reported by the decoder (offset list
+   format) with the injected jumps.
+
+   The first reported line is the initial offset; each following line
+   has to match one jump, within one video frame.
+ */
+static bool check_jumps(const std::string& output, const ltcgen_t& gen, std::string& msg)
+{
+  std::istringstream in(output);
+  std::vector<int64_t> inframes;
+  std::vector<int64_t> deltas;
+  int64_t inframe(0), ltcframe(0), delta(0);
+  while( in >> inframe >> ltcframe >> delta ){
+    inframes.push_back(inframe);
+    deltas.push_back(delta);
+  }
+  std::ostringstream err;
+  if( deltas.empty() || (deltas[0] != gen.start_frame) ){
+    err << "initial offset " << (deltas.empty() ? -1 : deltas[0]) << " instead of " << gen.start_frame;
+    msg = err.str();
+    return false;
+  }
+  if( deltas.size() != gen.jumps.size()+1 ){
+    err << deltas.size()-1 << " jumps instead of " << gen.jumps.size();
+    msg = err.str();
+    return false;
+  }
+  int64_t offset(gen.start_frame);
+  for(uint32_t k=0;k<gen.jumps.size();++k){
+    offset += gen.jumps[k].delta;
+    if( (llabs(inframes[k+1]-gen.jumps[k].frame) > 1) || (deltas[k+1] != offset) ){
+      err << "jump " << k << " at frame " << inframes[k+1] << " offset " << deltas[k+1] <<
+        " instead of frame " << gen.jumps[k].frame << " offset " << offset;
+      msg = err.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+   Scan and sort one test file with LTC decimation 'factor', and check
+   the result. Returns false on failure, with a message in 'msg'.
+ */
+static bool run_case(const char* fname, const ltcgen_t& gen, uint32_t factor, double& t_scan, double& t_sort, std::string& msg)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  try{
+    decoder_t dec(fname,0,std::set<uint32_t>(),gen.ltc_channel,1,out,log);
+    dec.b_list = true;
+    dec.set_decimation(factor);
+    double t0(now());
+    dec.scan_frame_map();
+    double t1(now());
+    dec.sort_frames();
+    double t2(now());
+    t_scan = t1-t0;
+    t_sort = t2-t1;
+    return check_jumps(out.str(),gen,msg);
+  }
+  catch( const std::exception& e ){
+    msg = e.what();
+  }
+  return false;
+}
+
+/**
+   Offset list of a test file in one of the scan modes of
+   ltcvideosplit: "serial" (default), "-a", "-k 4", "-1", "-P", "-S"
+   or "-p". Returns false on error, with the message in 'output'.
+ */
+static bool scan_mode(const char* fname, const ltcgen_t& gen, const std::string& mode, std::string& output)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  try{
+    decoder_t dec(fname,0,std::set<uint32_t>(),gen.ltc_channel,1,out,log);
+    dec.b_list = true;
+    dec.b_audioonly = (mode == "-a");
+    if( mode == "-k 4" ){
+      dec.scan_frame_map_parallel(4);
+      dec.sort_frames();
+    }else if( mode == "-1" ){
+      dec.scan_and_sort();
+    }else if( mode == "-P" ){
+      dec.b_pipeline = true;
+      dec.scan_frame_map();
+      dec.sort_frames();
+    }else if( mode == "-S" ){
+      dec.b_keep_records = false;
+      dec.scan_stream();
+    }else if( mode == "-p" ){
+      dec.b_keep_records = false;
+      dec.scan_probe(1.0);
+    }else{
+      dec.scan_frame_map();
+      dec.sort_frames();
+    }
+    output = out.str();
+    return true;
+  }
+  catch( const std::exception& e ){
+    output = e.what();
+  }
+  return false;
+}
+
+/**
+   Start of the steady state: the allocation count after the first
+   'warmup' LTC frames. In pipelined mode this is called from the LTC
+   decoding thread.
+ */
+class steady_state_t : public decoder_events_t {
+public:
+  steady_state_t(uint32_t warmup_) : warmup(warmup_), nframes(0), n0(0) {};
+  void ltc_frame(const ltc_record_t& rec, uint32_t frame)
+  {
+    if( ++nframes == warmup )
+      n0 = nallocs.load();
+  };
+  uint32_t warmup;
+  std::atomic<uint32_t> nframes;
+  std::atomic<uint64_t> n0;
+};
+
+/**
+   Number of allocations (operator new) while scanning a test file in
+   mode "scan", "scan/4", "pipeline" or "stream", once the decoder is
+   in steady state (after WARMUP_FRAMES LTC frames). Returns -1 on
+   error or if the file is too short for the warm-up.
+ */
+static int64_t scan_allocations(const char* fname, const ltcgen_t& gen, const std::string& mode)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  try{
+    decoder_t dec(fname,0,std::set<uint32_t>(),gen.ltc_channel,1,out,log);
+    steady_state_t steady(WARMUP_FRAMES);
+    dec.events = &steady;
+    dec.b_list = true;
+    dec.set_decimation((mode == "scan/4") ? 4 : 1);
+    dec.b_pipeline = (mode == "pipeline");
+    if( mode == "stream" )
+      dec.scan_stream();
+    else
+      dec.scan_frame_map();
+    if( steady.nframes < steady.warmup ){
+      std::cerr << "Error: the test file is too short for the warm-up." << std::endl;
+      return -1;
+    }
+    return nallocs-steady.n0;
+  }
+  catch( const std::exception& e ){
+    std::cerr << "Error: " << e.what() << std::endl;
+  }
+  return -1;
+}
+
+/**
+   LTC frame number in the frame map of video frame 'frame' of a test
+   file: fstep entries per LTC frame, a jump takes effect at the first
+   LTC frame at or after its video frame.
+ */
+static int64_t expected_ltcframe(const ltcgen_t& gen, uint32_t frame)
+{
+  int64_t ltcframe(gen.start_frame);
+  for(std::vector<ltcgen_jump_t>::const_iterator it=gen.jumps.begin();it!=gen.jumps.end();++it)
+    if( it->frame <= frame-frame%gen.fstep )
+      ltcframe += it->delta;
+  return gen.fstep*ltcframe+frame;
+}
+
+/**
+   Write the frame map of a test file (option -m) and read it back
+   with framemap_t: header, and the LTC frame and flags of the video
+   frame in the middle of each section between two jumps, and of the
+   following frame (counted on if fstep > 1).
+ */
+static bool check_framemap(const char* fname, const ltcgen_t& gen, std::string& msg)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  std::string mapname(std::string(fname)+".map");
+  try{
+    {
+      decoder_t dec(fname,0,std::set<uint32_t>(),gen.ltc_channel,gen.fstep,out,log);
+      dec.b_list = true;
+      dec.b_framemap = true;
+      dec.scan_frame_map();
+      dec.sort_frames();
+      dec.write_framemap(mapname);
+    }
+    framemap_t map(mapname);
+    unlink(mapname.c_str());
+    const framemap_header_t& h(map.header());
+    uint32_t nframes(gen.duration*gen.fps*gen.fstep);
+    std::ostringstream err;
+    if( (memcmp(h.magic,FRAMEMAP_MAGIC,8) != 0) || (h.header_size != sizeof(framemap_header_t)) ||
+        (h.entry_size != sizeof(framemap_entry_t)) || (h.fstep != gen.fstep) )
+      err << "invalid header";
+    else if( (h.fps_num <= 0) || (h.fps_den != (int32_t)(gen.fps*gen.fstep)*h.fps_num) )
+      err << "frame duration " << h.fps_num << "/" << h.fps_den;
+    else if( (h.video_time_base_num <= 0) || (h.video_time_base_den <= 0) )
+      err << "video time base " << h.video_time_base_num << "/" << h.video_time_base_den;
+    else if( (h.sample_rate != (int32_t)gen.sample_rate) ||
+             (h.audio_time_base_num*(int64_t)gen.sample_rate != h.audio_time_base_den) )
+      err << "audio time base " << h.audio_time_base_num << "/" << h.audio_time_base_den;
+    else if( (map.size() < nframes) || (map.size() >= nframes+gen.fstep) )
+      err << map.size() << " entries instead of " << nframes;
+    for(uint32_t k=0;err.str().empty() && (k<=gen.jumps.size());++k){
+      uint32_t first((k == 0) ? 0 : gen.jumps[k-1].frame);
+      uint32_t end((k == gen.jumps.size()) ? nframes : gen.jumps[k].frame);
+      uint32_t frame((first+end)/2);
+      frame -= frame % gen.fstep;
+      for(uint32_t f=frame;f<=frame+1;++f){
+        const framemap_entry_t& e(map[f]);
+        uint32_t flags((f % gen.fstep) ? FRAMEMAP_EXTRAPOLATED : FRAMEMAP_VALID);
+        if( ((int64_t)e.ltcframe != expected_ltcframe(gen,f)) || (e.flags != flags) ){
+          err << "frame " << f << ": LTC frame " << e.ltcframe << " flags " << e.flags <<
+            " instead of " << expected_ltcframe(gen,f) << " flags " << flags;
+          break;
+        }
+      }
+    }
+    msg = err.str();
+    return msg.empty();
+  }
+  catch( const std::exception& e ){
+    unlink(mapname.c_str());
+    msg = e.what();
+  }
+  return false;
+}
+
+/**
+   Number of video packets in a file, -1 if it can not be read.
+ */
+static int64_t count_video_frames(const std::string& filename)
+{
+  AVFormatContext* ic(NULL);
+  if( avformat_open_input(&ic,filename.c_str(),NULL,NULL) < 0 )
+    return -1;
+  int64_t n(-1);
+  if( avformat_find_stream_info(ic,NULL) >= 0 ){
+    int video(av_find_best_stream(ic,AVMEDIA_TYPE_VIDEO,-1,-1,NULL,0));
+    if( video >= 0 ){
+      n = 0;
+      AVPacket packet;
+      av_init_packet( &packet );
+      while( av_read_frame( ic, &packet ) >= 0 ){
+        if( packet.stream_index == video )
+          ++n;
+        av_free_packet( &packet );
+      }
+    }
+  }
+  avformat_close_input(&ic);
+  return n;
+}
+
+/**
+   Split a test file frame accurately (options -x -r) and check that
+   each segment has as many video frames as there are between its
+   sync change and the next one.
+ */
+static bool check_split(const char* fname, const ltcgen_t& gen, std::string& msg)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  std::vector<uint32_t> inframes;
+  std::vector<uint32_t> ltcframes;
+  try{
+    decoder_t dec(fname,0,std::set<uint32_t>(),gen.ltc_channel,1,out,log);
+    dec.b_list = true;
+    dec.b_split = true;
+    dec.b_smartrender = true;
+    dec.exportjobs = 1;
+    dec.scan_frame_map();
+    dec.sort_frames();
+    dec.write_segments();
+    std::istringstream in(out.str());
+    int64_t inframe(0), ltcframe(0), delta(0);
+    while( in >> inframe >> ltcframe >> delta ){
+      inframes.push_back(inframe);
+      ltcframes.push_back(ltcframe);
+    }
+  }
+  catch( const std::exception& e ){
+    msg = e.what();
+    return false;
+  }
+  std::string name(fname);
+  size_t dot(name.rfind('.'));
+  uint32_t nframes(gen.duration*gen.fps*gen.fstep);
+  std::ostringstream err;
+  for(uint32_t k=0;k<inframes.size();++k){
+    char ctmp[32];
+    snprintf(ctmp,sizeof(ctmp),".%05d",ltcframes[k]);
+    std::string segname(name.substr(0,dot)+ctmp+name.substr(dot));
+    int64_t n(count_video_frames(segname));
+    unlink(segname.c_str());
+    int64_t expected(((k+1 < inframes.size()) ? inframes[k+1] : nframes)-inframes[k]);
+    if( err.str().empty() && (n != expected) )
+      err << "segment " << k << ": " << n << " frames instead of " << expected;
+  }
+  if( inframes.size() != gen.jumps.size()+1 )
+    err << inframes.size() << " segments instead of " << gen.jumps.size()+1;
+  msg = err.str();
+  return msg.empty();
+}
+
+/**
+   Path of a test file in TMPDIR (default /tmp), unique per process.
+ */
+static std::string test_path(const std::string& name)
+{
+  const char* tmpdir(getenv("TMPDIR"));
+  char ctmp[1024];
+  snprintf(ctmp,sizeof(ctmp),"%s/ltcbench-%d-%s",tmpdir ? tmpdir : "/tmp",(int)getpid(),name.c_str());
+  return ctmp;
+}
+
+/**
+   Write a test file with LTC in the last audio channel and 'njumps'
+   random LTC jumps, evenly spread, and 'fstep' video frames per LTC
+   frame; the container is deduced from the file name. Returns the
+   generator, which holds the expected jumps.
+ */
+static ltcgen_t make_test_file(AVSampleFormat fmt, uint32_t channels, uint32_t fps, double duration, uint32_t bframes, uint32_t fstep, uint32_t njumps, const std::string& filename)
+{
+  ltcgen_t gen;
+  gen.sample_fmt = fmt;
+  gen.channels = channels;
+  gen.ltc_channel = channels-1;
+  gen.fps = fps;
+  gen.duration = duration;
+  gen.start_frame = START_FRAME;
+  gen.bframes = bframes;
+  gen.fstep = fstep;
+  uint32_t nframes(duration*fps*fstep);
+  for(uint32_t k=0;k<njumps;++k){
+    ltcgen_jump_t jump;
+    jump.frame = nframes*(k+1)/(njumps+1) + rand() % fps;
+    jump.delta = (rand() % 1000) - 500;
+    if( jump.delta == 0 )
+      jump.delta = 1;
+    gen.jumps.push_back(jump);
+  }
+  gen.write(filename);
+  return gen;
+}
+
+static double file_mbytes(const std::string& filename)
+{
+  struct stat st;
+  if( stat(filename.c_str(),&st) == 0 )
+    return st.st_size/1.0e6;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  try{
+    double duration((argc > 1) ? atof(argv[1]) : DURATION);
+    av_register_all();
+    av_log_set_level(AV_LOG_ERROR);
+    const bench_case_t cases[] = {
+      { AV_SAMPLE_FMT_S16, 2, 25 },
+      { AV_SAMPLE_FMT_S16P, 2, 25 },
+      { AV_SAMPLE_FMT_S32, 2, 25 },
+      { AV_SAMPLE_FMT_FLT, 2, 25 },
+      { AV_SAMPLE_FMT_FLTP, 2, 25 },
+      { AV_SAMPLE_FMT_U8, 2, 25 },
+      { AV_SAMPLE_FMT_S16, 1, 25 },
+      { AV_SAMPLE_FMT_S16, 8, 25 },
+      { AV_SAMPLE_FMT_S16, 2, 24 },
+      { AV_SAMPLE_FMT_S16, 2, 30 } };
+    srand(1);
+    uint32_t nfailed(0);
+    const uint32_t factors[] = { 1, 2, 4 };
+    const uint32_t nfactors(sizeof(factors)/sizeof(factors[0]));
+    printf("%-6s %3s %3s | %10s %8s | %10s %8s | %7s %7s | %s\n","format","ch","fps",
+           "scan (xRT)","MB/s","sort (xRT)","MB/s","scan/2","scan/4","jumps");
+    for(uint32_t c=0;c<sizeof(cases)/sizeof(cases[0]);++c){
+      std::string fname(test_path(std::to_string(c)+".nut"));
+      ltcgen_t gen(make_test_file(cases[c].fmt,cases[c].channels,cases[c].fps,duration,0,1,NJUMPS,fname));
+      double mbytes(file_mbytes(fname));
+      // scan and sort time for each decimation factor:
+      double t_scan[nfactors];
+      double t_sort[nfactors];
+      std::string msg;
+      bool b_ok(true);
+      for(uint32_t f=0;f<nfactors;++f){
+        t_scan[f] = t_sort[f] = 0;
+        std::string fmsg;
+        if( !run_case(fname.c_str(),gen,factors[f],t_scan[f],t_sort[f],fmsg) && b_ok ){
+          b_ok = false;
+          char ctmp[32];
+          snprintf(ctmp,sizeof(ctmp),"decimation %d: ",factors[f]);
+          msg = ctmp + fmsg;
+        }
+      }
+      unlink(fname.c_str());
+      if( !b_ok )
+        ++nfailed;
+      printf("%-6s %3d %3d | %10.1f %8.1f | %10.1f %8.1f | %6.2fx %6.2fx | %s%s\n",
+             av_get_sample_fmt_name(gen.sample_fmt),gen.channels,gen.fps,
+             duration/std::max(t_scan[0],1e-9),mbytes/std::max(t_scan[0],1e-9),
+             duration/std::max(t_sort[0],1e-9),mbytes/std::max(t_sort[0],1e-9),
+             t_scan[0]/std::max(t_scan[1],1e-9),t_scan[0]/std::max(t_scan[2],1e-9),
+             b_ok ? "ok" : "FAILED: ",msg.c_str());
+    }
+    // input I/O layers, on a file with the first case's parameters:
+    {
+      std::string fname(test_path("io.nut"));
+      ltcgen_t gen(make_test_file(cases[0].fmt,cases[0].channels,cases[0].fps,duration,0,1,0,fname));
+      double mbytes(file_mbytes(fname));
+      const char* iomodes[] = { "default", "mmap", "read" };
+      printf("\n%-7s | %10s %8s | %s\n","io","scan (xRT)","MB/s","jumps");
+      for(uint32_t m=0;m<sizeof(iomodes)/sizeof(iomodes[0]);++m){
+        input_io_select(iomodes[m]);
+        double t_scan(0);
+        double t_sort(0);
+        std::string msg;
+        bool b_ok(run_case(fname.c_str(),gen,1,t_scan,t_sort,msg));
+        if( !b_ok )
+          ++nfailed;
+        printf("%-7s | %10.1f %8.1f | %s%s\n",iomodes[m],
+               duration/std::max(t_scan,1e-9),mbytes/std::max(t_scan,1e-9),
+               b_ok ? "ok" : "FAILED: ",msg.c_str());
+      }
+      input_io_select("default");
+      unlink(fname.c_str());
+    }
+    // the alternative scan modes have to report exactly the sync
+    // changes of the serial two-pass scan:
+    {
+      printf("\n%-6s %3s | %-6s | %s\n","format","ch","mode","same as serial");
+      const char* modes[] = { "-k 4", "-1", "-P", "-S", "-p" };
+      const AVSampleFormat fmts[] = { AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP };
+      for(uint32_t c=0;c<sizeof(fmts)/sizeof(fmts[0]);++c){
+        std::string fname(test_path("modes-"+std::to_string(c)+".nut"));
+        ltcgen_t gen(make_test_file(fmts[c],2,25,duration,0,1,NJUMPS,fname));
+        std::string serial;
+        bool b_serial(scan_mode(fname.c_str(),gen,"serial",serial));
+        for(uint32_t m=0;m<sizeof(modes)/sizeof(modes[0]);++m){
+          std::string output;
+          bool b_ok(b_serial && scan_mode(fname.c_str(),gen,modes[m],output) && (output == serial));
+          if( !b_ok )
+            ++nfailed;
+          printf("%-6s %3d | %-6s | %s\n",av_get_sample_fmt_name(gen.sample_fmt),gen.channels,modes[m],
+                 b_ok ? "ok" : (b_serial ? "FAILED: different sync changes" : "FAILED: serial scan"));
+        }
+        unlink(fname.c_str());
+      }
+    }
+    // B-frames: the video frames are numbered in presentation order,
+    // whether their positions are taken from the index (-a) or from
+    // the demuxed packets:
+    {
+      std::string fname(test_path("bframes.mov"));
+      ltcgen_t gen(make_test_file(cases[0].fmt,cases[0].channels,cases[0].fps,duration,2,1,NJUMPS,fname));
+      std::string serial;
+      std::string audioonly;
+      std::string msg;
+      bool b_ok(scan_mode(fname.c_str(),gen,"serial",serial));
+      if( !b_ok )
+        msg = serial;
+      else
+        b_ok = check_jumps(serial,gen,msg);
+      if( b_ok && !(scan_mode(fname.c_str(),gen,"-a",audioonly) && (audioonly == serial)) ){
+        b_ok = false;
+        msg = "-a reports other sync changes";
+      }
+      if( !b_ok )
+        ++nfailed;
+      printf("\n%-8s | %s\n","B-frames","jumps, -a");
+      printf("%-8s | %s%s\n","mov",b_ok ? "ok" : "FAILED: ",msg.c_str());
+      unlink(fname.c_str());
+    }
+    // frame accurate splitting (-r) of a file with B-frames in open
+    // GOPs, cut inside GOPs:
+    {
+      std::string fname(test_path("split.mov"));
+      ltcgen_t gen(make_test_file(cases[0].fmt,cases[0].channels,cases[0].fps,duration,2,1,NJUMPS,fname));
+      std::string msg;
+      bool b_ok(check_split(fname.c_str(),gen,msg));
+      if( !b_ok )
+        ++nfailed;
+      printf("\n%-8s | %s\n","split -r","frames per segment");
+      printf("%-8s | %s%s\n","B-frames",b_ok ? "ok" : "FAILED: ",msg.c_str());
+      unlink(fname.c_str());
+    }
+    // frame maps (-m), read back with framemap_t:
+    {
+      printf("\n%-8s %3s %6s | %s\n","video","fps","fstep","frame map");
+      const char* names[] = { "raw", "B-frames", "raw" };
+      const uint32_t bframes[] = { 0, 2, 0 };
+      const uint32_t fsteps[] = { 1, 1, 2 };
+      for(uint32_t c=0;c<sizeof(names)/sizeof(names[0]);++c){
+        std::string fname(test_path("map-"+std::to_string(c)+(bframes[c] ? ".mov" : ".nut")));
+        ltcgen_t gen(make_test_file(cases[0].fmt,cases[0].channels,cases[0].fps,duration,bframes[c],fsteps[c],NJUMPS,fname));
+        std::string msg;
+        bool b_ok(check_framemap(fname.c_str(),gen,msg));
+        if( !b_ok )
+          ++nfailed;
+        printf("%-8s %3d %6d | %s%s\n",names[c],gen.fps*gen.fstep,gen.fstep,b_ok ? "ok" : "FAILED: ",msg.c_str());
+        unlink(fname.c_str());
+      }
+    }
+    // steady state: no allocations in the per-packet path once the
+    // buffers are warmed up (libavformat and libltc use malloc, which
+    // is not counted):
+    {
+      std::string fname(test_path("allocs.nut"));
+      ltcgen_t gen(make_test_file(cases[0].fmt,cases[0].channels,cases[0].fps,duration,0,1,0,fname));
+      printf("\n%-8s | %10s | %s\n","mode","allocs","steady state");
+      const char* modes[] = { "scan", "scan/4", "pipeline", "stream" };
+      for(uint32_t m=0;m<sizeof(modes)/sizeof(modes[0]);++m){
+        int64_t a(scan_allocations(fname.c_str(),gen,modes[m]));
+        bool b_ok(a == 0);
+        if( !b_ok )
+          ++nfailed;
+        printf("%-8s | %10lld | %s\n",modes[m],(long long)a,
+               b_ok ? "ok" : "FAILED: allocations after the warm-up");
+      }
+      unlink(fname.c_str());
+    }
+    if( nfailed ){
+      std::cerr << nfailed << " test files failed." << std::endl;
+      return 1;
+    }
+  }
+  catch( const std::exception& e ){
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
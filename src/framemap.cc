@@ -0,0 +1,107 @@
+/*
+  framemap - binary table of the LTC frame of each video frame
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "framemap.h"
+#include "error.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+framemap_writer_t::framemap_writer_t()
+{
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,FRAMEMAP_MAGIC,8);
+  header.version = FRAMEMAP_VERSION;
+  header.header_size = sizeof(framemap_header_t);
+  header.entry_size = sizeof(framemap_entry_t);
+  header.fstep = 1;
+}
+
+void framemap_writer_t::set(uint32_t inframe, const framemap_entry_t& e)
+{
+  if( inframe >= entries.size() ){
+    framemap_entry_t unknown;
+    memset(&unknown,0,sizeof(unknown));
+    entries.resize(inframe+1,unknown);
+  }
+  entries[inframe] = e;
+}
+
+void framemap_writer_t::save(const std::string& filename) const
+{
+  // write to a temporary file first, a map file is either complete or absent:
+  std::string tmpfile(filename+".tmp");
+  FILE* fh(fopen(tmpfile.c_str(),"wb"));
+  if( !fh )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to create frame map file \"%s\".",tmpfile.c_str());
+  framemap_header_t h(header);
+  h.nframes = entries.size();
+  bool ok(fwrite(&h,sizeof(h),1,fh) == 1);
+  ok = ok && (entries.empty() || (fwrite(&(entries[0]),sizeof(framemap_entry_t),entries.size(),fh) == entries.size()));
+  ok = (fclose(fh) == 0) && ok;
+  if( !ok ){
+    unlink(tmpfile.c_str());
+    throw error_msg_t(__FILE__,__LINE__,"Unable to write frame map file \"%s\".",tmpfile.c_str());
+  }
+  if( rename(tmpfile.c_str(),filename.c_str()) != 0 ){
+    unlink(tmpfile.c_str());
+    throw error_msg_t(__FILE__,__LINE__,"Unable to rename frame map file to \"%s\".",filename.c_str());
+  }
+}
+
+framemap_t::framemap_t(const std::string& filename)
+  : data(MAP_FAILED),
+    len(0),
+    hdr(NULL),
+    entries(NULL)
+{
+  int fd(open(filename.c_str(),O_RDONLY));
+  if( fd < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to open frame map file \"%s\".",filename.c_str());
+  struct stat st;
+  if( (fstat(fd,&st) == 0) && (st.st_size >= (off_t)sizeof(framemap_header_t)) ){
+    len = st.st_size;
+    data = mmap(NULL,len,PROT_READ,MAP_SHARED,fd,0);
+  }
+  close(fd);
+  if( data == MAP_FAILED )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to map frame map file \"%s\".",filename.c_str());
+  hdr = (const framemap_header_t*)data;
+  if( (memcmp(hdr->magic,FRAMEMAP_MAGIC,8) != 0) || (hdr->version != FRAMEMAP_VERSION) ||
+      (hdr->header_size != sizeof(framemap_header_t)) || (hdr->entry_size != sizeof(framemap_entry_t)) ||
+      (hdr->nframes > (len-sizeof(framemap_header_t))/sizeof(framemap_entry_t)) ){
+    munmap(data,len);
+    throw error_msg_t(__FILE__,__LINE__,"Invalid frame map file \"%s\".",filename.c_str());
+  }
+  entries = (const framemap_entry_t*)((const char*)data + hdr->header_size);
+}
+
+framemap_t::~framemap_t()
+{
+  munmap(data,len);
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
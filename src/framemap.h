@@ -0,0 +1,119 @@
+/*
+  framemap - binary table of the LTC frame of each video frame
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef FRAMEMAP_H
+#define FRAMEMAP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define FRAMEMAP_MAGIC "LTCFMAP"
+#define FRAMEMAP_VERSION 1
+// the LTC frame was decoded for this video frame:
+#define FRAMEMAP_VALID 1
+// the LTC frame was counted on from the last decoded frame:
+#define FRAMEMAP_EXTRAPOLATED 2
+
+/**
+   Header of a frame map file, 64 bytes.
+
+   A frame map file is the header followed by 'nframes' entries, one
+   per input video frame in the order of the input file (with 'fstep'
+   > 1, the frames between two decoded ones are counted on). The file is
+   written in host byte order, and can be mapped into memory for
+   random access to any frame.
+ */
+struct framemap_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t entry_size;
+  uint32_t fstep;
+  uint64_t nframes;
+  // video frame duration in seconds is fps_num/fps_den:
+  int32_t fps_num;
+  int32_t fps_den;
+  int32_t video_time_base_num;
+  int32_t video_time_base_den;
+  int32_t audio_time_base_num;
+  int32_t audio_time_base_den;
+  int32_t sample_rate;
+  uint32_t reserved[1];
+};
+
+static_assert(sizeof(framemap_header_t) == 64,"frame map header must be 64 bytes");
+
+/**
+   Frame map entry of one input video frame, 12 bytes.
+ */
+struct framemap_entry_t {
+  // LTC frame number:
+  uint32_t ltcframe;
+  // position of the video frame relative to the end of the LTC
+  // frame, in audio samples (valid frames only):
+  int32_t offset;
+  // FRAMEMAP_VALID or FRAMEMAP_EXTRAPOLATED, 0 if unknown:
+  uint32_t flags;
+};
+
+static_assert(sizeof(framemap_entry_t) == 12,"frame map entry must be 12 bytes");
+
+/**
+   Writer of a frame map file; entries are collected in memory.
+ */
+class framemap_writer_t {
+public:
+  framemap_writer_t();
+  /**
+     Set the entry of input video frame 'inframe'; missing entries
+     before it are unknown.
+   */
+  void set(uint32_t inframe, const framemap_entry_t& e);
+  void save(const std::string& filename) const;
+  framemap_header_t header;
+private:
+  std::vector<framemap_entry_t> entries;
+};
+
+/**
+   Read-only memory-mapped frame map file.
+ */
+class framemap_t {
+public:
+  framemap_t(const std::string& filename);
+  ~framemap_t();
+  const framemap_header_t& header() const { return *hdr; };
+  uint64_t size() const { return hdr->nframes; };
+  const framemap_entry_t& operator[](uint64_t k) const { return entries[k]; };
+private:
+  framemap_t(const framemap_t&);
+  void* data;
+  size_t len;
+  const framemap_header_t* hdr;
+  const framemap_entry_t* entries;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
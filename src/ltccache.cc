@@ -0,0 +1,240 @@
+/*
+  persistent cache of decoded LTC maps
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "ltccache.h"
+#include "error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define LTCCACHE_MAGIC "LTCMAP\0"
+#define LTCCACHE_VERSION 1
+// number of bytes at the start of the file included in the hash:
+#define LTCCACHE_HASHSIZE 65536
+
+static uint64_t fnv1a(const uint8_t* data, size_t len, uint64_t h = 14695981039346656037ULL)
+{
+  for(size_t k=0;k<len;++k){
+    h ^= data[k];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+file_id_t::file_id_t()
+  : size(0),
+    mtime_ns(0),
+    hash(0)
+{
+}
+
+file_id_t::file_id_t(const std::string& filename)
+  : path(filename),
+    size(0),
+    mtime_ns(0),
+    hash(0)
+{
+  char rpath[PATH_MAX];
+  if( realpath(filename.c_str(),rpath) )
+    path = rpath;
+  struct stat st;
+  if( stat(filename.c_str(),&st) != 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to stat file \"%s\".",filename.c_str());
+  size = st.st_size;
+  mtime_ns = (int64_t)st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+  FILE* fh(fopen(filename.c_str(),"rb"));
+  if( !fh )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to open file \"%s\".",filename.c_str());
+  std::vector<uint8_t> buf(LTCCACHE_HASHSIZE);
+  size_t len(fread(&(buf[0]),1,buf.size(),fh));
+  fclose(fh);
+  hash = fnv1a(&(buf[0]),len);
+}
+
+bool file_id_t::operator==(const file_id_t& o) const
+{
+  return (path == o.path) && (size == o.size) && (mtime_ns == o.mtime_ns) && (hash == o.hash);
+}
+
+template<class T> static void write_val(FILE* fh, const T& v)
+{
+  if( fwrite(&v,sizeof(T),1,fh) != 1 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to write cache file.");
+}
+
+template<class T> static bool read_val(FILE* fh, T& v)
+{
+  return fread(&v,sizeof(T),1,fh) == 1;
+}
+
+/**
+   True if 'n' items of 'size' bytes fit into the rest of the file
+   'fsize' bytes long; counts read from a corrupt file are rejected
+   before anything is allocated.
+ */
+static bool fits(FILE* fh, int64_t fsize, uint64_t n, size_t size)
+{
+  int64_t pos(ftello(fh));
+  return (pos >= 0) && (pos <= fsize) && (n <= (uint64_t)(fsize-pos)/size);
+}
+
+ltc_cache_t::ltc_cache_t()
+  : channel(0),
+    fps_num(0),
+    fps_den(0),
+    sample_rate(0),
+    frame_duration(0)
+{
+  video_time_base.num = audio_time_base.num = 0;
+  video_time_base.den = audio_time_base.den = 1;
+}
+
+std::string ltc_cache_t::cachefile(const std::string& filename, const std::string& cachedir)
+{
+  if( cachedir.empty() )
+    return filename + ".ltcmap";
+  std::string path(filename);
+  char rpath[PATH_MAX];
+  if( realpath(filename.c_str(),rpath) )
+    path = rpath;
+  char name[32];
+  sprintf(name,"%016llx.ltcmap",(unsigned long long)fnv1a((const uint8_t*)path.c_str(),path.size()));
+  return cachedir + "/" + name;
+}
+
+bool ltc_cache_t::load(const std::string& cachefile, const file_id_t& fid, uint32_t chan)
+{
+  FILE* fh(fopen(cachefile.c_str(),"rb"));
+  if( !fh )
+    return false;
+  struct stat st;
+  if( fstat(fileno(fh),&st) != 0 ){
+    fclose(fh);
+    return false;
+  }
+  int64_t fsize(st.st_size);
+  bool ok(true);
+  char magic[8];
+  uint32_t version(0);
+  ok = ok && (fread(magic,1,8,fh) == 8) && (memcmp(magic,LTCCACHE_MAGIC,8) == 0);
+  ok = ok && read_val(fh,version) && (version == LTCCACHE_VERSION);
+  uint32_t pathlen(0);
+  ok = ok && read_val(fh,pathlen) && (pathlen < PATH_MAX) && fits(fh,fsize,pathlen,1);
+  if( ok ){
+    std::vector<char> path(pathlen+1,0);
+    ok = (fread(&(path[0]),1,pathlen,fh) == pathlen);
+    id.path = &(path[0]);
+  }
+  ok = ok && read_val(fh,id.size) && read_val(fh,id.mtime_ns) && read_val(fh,id.hash);
+  ok = ok && (id == fid);
+  ok = ok && read_val(fh,channel) && (channel == chan);
+  ok = ok && read_val(fh,fps_num) && read_val(fh,fps_den);
+  ok = ok && read_val(fh,video_time_base.num) && read_val(fh,video_time_base.den);
+  ok = ok && read_val(fh,audio_time_base.num) && read_val(fh,audio_time_base.den);
+  ok = ok && read_val(fh,sample_rate) && read_val(fh,frame_duration);
+  uint64_t n(0);
+  ok = ok && read_val(fh,n) && fits(fh,fsize,n,sizeof(int64_t));
+  if( ok ){
+    video_frame_ends.resize(n);
+    ok = (n == 0) || (fread(&(video_frame_ends[0]),sizeof(int64_t),n,fh) == n);
+  }
+  ltc_record_t r0;
+  size_t recsize(sizeof(r0.off_start)+sizeof(r0.off_end)+
+                 sizeof(r0.tc.hours)+sizeof(r0.tc.mins)+sizeof(r0.tc.secs)+sizeof(r0.tc.frame)+
+                 sizeof(r0.tc.years)+sizeof(r0.tc.months)+sizeof(r0.tc.days));
+  ok = ok && read_val(fh,n) && fits(fh,fsize,n,recsize);
+  if( ok ){
+    records.resize(n);
+    for(uint64_t k=0;ok && (k<n);++k){
+      ltc_record_t& r(records[k]);
+      memset(&r.tc,0,sizeof(r.tc));
+      ok = read_val(fh,r.off_start) && read_val(fh,r.off_end) &&
+        read_val(fh,r.tc.hours) && read_val(fh,r.tc.mins) && read_val(fh,r.tc.secs) && read_val(fh,r.tc.frame) &&
+        read_val(fh,r.tc.years) && read_val(fh,r.tc.months) && read_val(fh,r.tc.days);
+    }
+  }
+  fclose(fh);
+  if( !ok ){
+    video_frame_ends.clear();
+    records.clear();
+  }
+  return ok;
+}
+
+void ltc_cache_t::save(const std::string& cachefile) const
+{
+  // write to a temporary file first, a cache file is either complete or absent:
+  std::string tmpfile(cachefile+".tmp");
+  FILE* fh(fopen(tmpfile.c_str(),"wb"));
+  if( !fh )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to create cache file \"%s\".",tmpfile.c_str());
+  try{
+    if( fwrite(LTCCACHE_MAGIC,1,8,fh) != 8 )
+      throw error_msg_t(__FILE__,__LINE__,"Unable to write cache file.");
+    write_val(fh,(uint32_t)LTCCACHE_VERSION);
+    write_val(fh,(uint32_t)id.path.size());
+    if( fwrite(id.path.c_str(),1,id.path.size(),fh) != id.path.size() )
+      throw error_msg_t(__FILE__,__LINE__,"Unable to write cache file.");
+    write_val(fh,id.size);
+    write_val(fh,id.mtime_ns);
+    write_val(fh,id.hash);
+    write_val(fh,channel);
+    write_val(fh,fps_num);
+    write_val(fh,fps_den);
+    write_val(fh,video_time_base.num);
+    write_val(fh,video_time_base.den);
+    write_val(fh,audio_time_base.num);
+    write_val(fh,audio_time_base.den);
+    write_val(fh,sample_rate);
+    write_val(fh,frame_duration);
+    write_val(fh,(uint64_t)video_frame_ends.size());
+    if( !video_frame_ends.empty() &&
+        (fwrite(&(video_frame_ends[0]),sizeof(int64_t),video_frame_ends.size(),fh) != video_frame_ends.size()) )
+      throw error_msg_t(__FILE__,__LINE__,"Unable to write cache file.");
+    write_val(fh,(uint64_t)records.size());
+    for(std::vector<ltc_record_t>::const_iterator r=records.begin();r!=records.end();++r){
+      write_val(fh,r->off_start);
+      write_val(fh,r->off_end);
+      write_val(fh,r->tc.hours);
+      write_val(fh,r->tc.mins);
+      write_val(fh,r->tc.secs);
+      write_val(fh,r->tc.frame);
+      write_val(fh,r->tc.years);
+      write_val(fh,r->tc.months);
+      write_val(fh,r->tc.days);
+    }
+  }
+  catch( ... ){
+    fclose(fh);
+    remove(tmpfile.c_str());
+    throw;
+  }
+  if( fclose(fh) != 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to write cache file \"%s\".",tmpfile.c_str());
+  if( rename(tmpfile.c_str(),cachefile.c_str()) != 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to rename cache file to \"%s\".",cachefile.c_str());
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
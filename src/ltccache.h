@@ -0,0 +1,97 @@
+/*
+  persistent cache of decoded LTC maps
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LTCCACHE_H
+#define LTCCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ltc.h>
+
+extern "C" {
+
+#include <libavutil/avutil.h>
+
+}
+
+/**
+   One decoded LTC frame, as delivered by the LTC decoder.
+ */
+struct ltc_record_t {
+  int64_t off_start;
+  int64_t off_end;
+  SMPTETimecode tc;
+};
+
+/**
+   Identity of an input file: path, size, modification time and a
+   hash of the first bytes of the file.
+ */
+class file_id_t {
+public:
+  file_id_t();
+  file_id_t(const std::string& filename);
+  bool operator==(const file_id_t& o) const;
+  std::string path;
+  uint64_t size;
+  int64_t mtime_ns;
+  uint64_t hash;
+};
+
+/**
+   LTC timeline, video frame positions and stream parameters of one
+   file, stored in a binary file next to the input file (sidecar) or
+   in a cache directory.
+
+   The file is written in host byte order.
+ */
+class ltc_cache_t {
+public:
+  ltc_cache_t();
+  /**
+     Name of the cache file for an input file; with an empty cache
+     directory this is the sidecar "<filename>.ltcmap".
+   */
+  static std::string cachefile(const std::string& filename, const std::string& cachedir);
+  /**
+     Load a cache file. Returns false if the file does not exist, is
+     invalid or was written for a different file identity or channel.
+   */
+  bool load(const std::string& cachefile, const file_id_t& id, uint32_t channel);
+  void save(const std::string& cachefile) const;
+  file_id_t id;
+  uint32_t channel;
+  int32_t fps_num;
+  int32_t fps_den;
+  AVRational video_time_base;
+  AVRational audio_time_base;
+  int32_t sample_rate;
+  uint32_t frame_duration;
+  std::vector<int64_t> video_frame_ends;
+  std::vector<ltc_record_t> records;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,302 @@
+/*
+  ltcgen - generate test files with LTC in the audio track
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "ltcgen.h"
+#include "error.h"
+#include <ltc.h>
+#include <math.h>
+#include <string.h>
+
+// size of the generated video frames:
+#define LTCGEN_WIDTH 32
+#define LTCGEN_HEIGHT 18
+// audio frame size of codecs without fixed frame size:
+#define LTCGEN_AUDIO_FRAME 1024
+// key frame interval of MPEG-4 video with B-frames:
+#define LTCGEN_GOP_SIZE 12
+
+ltcgen_t::ltcgen_t()
+  : fps(25),
+    sample_fmt(AV_SAMPLE_FMT_S16),
+    channels(2),
+    ltc_channel(0),
+    sample_rate(48000),
+    bframes(0),
+    fstep(1),
+    duration(60),
+    start_frame(0)
+{
+}
+
+static void write_packet(AVFormatContext* oc, AVStream* st, AVPacket* pkt)
+{
+  pkt->stream_index = st->index;
+  if( pkt->pts != AV_NOPTS_VALUE )
+    pkt->pts = av_rescale_q(pkt->pts, st->codec->time_base, st->time_base);
+  if( pkt->dts != AV_NOPTS_VALUE )
+    pkt->dts = av_rescale_q(pkt->dts, st->codec->time_base, st->time_base);
+  pkt->duration = av_rescale_q(pkt->duration, st->codec->time_base, st->time_base);
+  if( av_interleaved_write_frame(oc, pkt) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to write packet.");
+}
+
+/**
+   Encode the first 'n' samples of the LTC channel, with a sine tone
+   in all other channels.
+ */
+static void write_audio(AVFormatContext* oc, AVStream* st, const float* ltc, uint32_t n, uint32_t ltc_channel, int64_t& pts)
+{
+  AVCodecContext* c(st->codec);
+  AVFrame* frame(av_frame_alloc());
+  if( !frame )
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  frame->nb_samples = n;
+  frame->format = c->sample_fmt;
+  frame->channel_layout = c->channel_layout;
+  frame->channels = c->channels;
+  if( av_frame_get_buffer(frame, 0) < 0 ){
+    av_frame_free(&frame);
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  }
+  bool b_planar(av_sample_fmt_is_planar(c->sample_fmt));
+  for(int ch=0;ch<c->channels;++ch)
+    for(uint32_t k=0;k<n;++k){
+      float v(((uint32_t)ch == ltc_channel) ? ltc[k] : 0.25f*sinf(2.0f*M_PI*440.0f*(pts+k)/c->sample_rate));
+      uint32_t idx(b_planar ? k : k*c->channels+ch);
+      uint8_t* data(frame->data[b_planar ? ch : 0]);
+      switch( c->sample_fmt ){
+      case AV_SAMPLE_FMT_U8 :
+        data[idx] = 128+lrintf(127.0f*v);
+        break;
+      case AV_SAMPLE_FMT_S16 :
+      case AV_SAMPLE_FMT_S16P :
+        ((int16_t*)data)[idx] = lrintf(32767.0f*v);
+        break;
+      case AV_SAMPLE_FMT_S32 :
+        ((int32_t*)data)[idx] = lrint(2147483647.0*v);
+        break;
+      default:
+        ((float*)data)[idx] = v;
+      }
+    }
+  frame->pts = pts;
+  pts += n;
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  int got_packet(0);
+  int err(avcodec_encode_audio2(c, &pkt, frame, &got_packet));
+  av_frame_free(&frame);
+  if( err < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Error while encoding audio.");
+  if( got_packet )
+    write_packet(oc, st, &pkt);
+}
+
+static void write_video(AVFormatContext* oc, AVStream* st, uint32_t fno)
+{
+  AVCodecContext* c(st->codec);
+  AVFrame* frame(av_frame_alloc());
+  if( !frame )
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  frame->format = c->pix_fmt;
+  frame->width = c->width;
+  frame->height = c->height;
+  if( av_frame_get_buffer(frame, 32) < 0 ){
+    av_frame_free(&frame);
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  }
+  memset(frame->data[0], (fno*7) & 0xff, frame->linesize[0]*c->height);
+  memset(frame->data[1], 128, frame->linesize[1]*c->height/2);
+  memset(frame->data[2], 128, frame->linesize[2]*c->height/2);
+  frame->pts = fno;
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  int got_packet(0);
+  int err(avcodec_encode_video2(c, &pkt, frame, &got_packet));
+  av_frame_free(&frame);
+  if( err < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Error while encoding video.");
+  if( got_packet )
+    write_packet(oc, st, &pkt);
+}
+
+static AVCodecContext* add_stream(AVFormatContext* oc, AVCodecID id, AVStream*& st)
+{
+  AVCodec* codec(avcodec_find_encoder(id));
+  if( !codec )
+    throw error_msg_t(__FILE__,__LINE__,"Encoder for codec %d not found.",id);
+  st = avformat_new_stream(oc, codec);
+  if( !st )
+    throw error_msg_t(__FILE__,__LINE__,"Could not allocate output stream.");
+  if( oc->oformat->flags & AVFMT_GLOBALHEADER )
+    st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+  return st->codec;
+}
+
+void ltcgen_t::write(const std::string& filename) const
+{
+  if( !fps || !fstep || !channels || (ltc_channel >= channels) )
+    throw error_msg_t(__FILE__,__LINE__,"Invalid test file parameters.");
+  AVCodecID audio_codec(AV_CODEC_ID_PCM_S16LE);
+  switch( sample_fmt ){
+  case AV_SAMPLE_FMT_U8 :
+    audio_codec = AV_CODEC_ID_PCM_U8;
+    break;
+  case AV_SAMPLE_FMT_S16 :
+    audio_codec = AV_CODEC_ID_PCM_S16LE;
+    break;
+  case AV_SAMPLE_FMT_S16P :
+    audio_codec = AV_CODEC_ID_PCM_S16LE_PLANAR;
+    break;
+  case AV_SAMPLE_FMT_S32 :
+    audio_codec = AV_CODEC_ID_PCM_S32LE;
+    break;
+  case AV_SAMPLE_FMT_FLT :
+    audio_codec = AV_CODEC_ID_PCM_F32LE;
+    break;
+  case AV_SAMPLE_FMT_FLTP :
+    audio_codec = AV_CODEC_ID_AAC;
+    break;
+  default:
+    throw error_msg_t(__FILE__,__LINE__,"Unsupported sample format %s.",av_get_sample_fmt_name(sample_fmt));
+  }
+  AVFormatContext* oc(NULL);
+  avformat_alloc_output_context2(&oc, NULL, NULL, filename.c_str());
+  if( !oc )
+    throw error_msg_t(__FILE__,__LINE__,"Could not deduce output format from file name '%s'.", filename.c_str());
+  LTCEncoder* ltcenc(NULL);
+  try{
+    AVStream* vst(NULL);
+    AVCodecContext* vc(add_stream(oc, bframes ? AV_CODEC_ID_MPEG4 : AV_CODEC_ID_RAWVIDEO, vst));
+    if( bframes ){
+      vc->max_b_frames = bframes;
+      vc->gop_size = LTCGEN_GOP_SIZE;
+    }
+    vc->width = LTCGEN_WIDTH;
+    vc->height = LTCGEN_HEIGHT;
+    vc->pix_fmt = AV_PIX_FMT_YUV420P;
+    vc->time_base.num = 1;
+    vc->time_base.den = fps*fstep;
+    vst->time_base = vc->time_base;
+    if( avcodec_open2(vc, vc->codec, NULL) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not open video encoder.");
+    AVStream* ast(NULL);
+    AVCodecContext* ac(add_stream(oc, audio_codec, ast));
+    ac->sample_fmt = sample_fmt;
+    ac->sample_rate = sample_rate;
+    ac->channels = channels;
+    ac->channel_layout = av_get_default_channel_layout(channels);
+    ac->time_base.num = 1;
+    ac->time_base.den = sample_rate;
+    ast->time_base = ac->time_base;
+    if( audio_codec == AV_CODEC_ID_AAC ){
+      ac->bit_rate = 128000*channels;
+      ac->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    }
+    if( avcodec_open2(ac, ac->codec, NULL) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not open audio encoder.");
+    uint32_t frame_size(ac->frame_size ? ac->frame_size : LTCGEN_AUDIO_FRAME);
+    if( avio_open(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not create output file '%s'.", filename.c_str());
+    if( avformat_write_header(oc, NULL) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not write header of '%s'.", filename.c_str());
+    ltcenc = ltc_encoder_create(sample_rate, fps, (fps == 25) ? LTC_TV_625_50 : ((fps == 24) ? LTC_TV_FILM_24 : LTC_TV_1125_60), 0);
+    if( !ltcenc )
+      throw error_msg_t(__FILE__,__LINE__,"Could not create LTC encoder.");
+    std::vector<ltcsnd_sample_t> ltcbuf(ltc_encoder_get_buffersize(ltcenc));
+    std::vector<float> fifo;
+    uint32_t nframes(duration*fps);
+    uint32_t nextjump(0);
+    int64_t ltcframe(start_frame);
+    int64_t apts(0);
+    for(uint32_t f=0;f<nframes;++f){
+      while( (nextjump < jumps.size()) && (jumps[nextjump].frame <= f*fstep) )
+        ltcframe += jumps[nextjump++].delta;
+      SMPTETimecode tc;
+      memset(&tc, 0, sizeof(tc));
+      strcpy(tc.timezone, "+0000");
+      tc.frame = ltcframe % fps;
+      tc.secs = (ltcframe/fps) % 60;
+      tc.mins = (ltcframe/(60*fps)) % 60;
+      tc.hours = (ltcframe/(3600*fps)) % 24;
+      ltc_encoder_set_timecode(ltcenc, &tc);
+      ltc_encoder_encode_frame(ltcenc);
+      int len(ltc_encoder_get_buffer(ltcenc, &(ltcbuf[0])));
+      for(int k=0;k<len;++k)
+        fifo.push_back((ltcbuf[k]-128)/128.0f);
+      for(uint32_t k=0;k<fstep;++k)
+        write_video(oc, vst, f*fstep+k);
+      uint32_t pos(0);
+      while( fifo.size()-pos >= frame_size ){
+        write_audio(oc, ast, &(fifo[pos]), frame_size, ltc_channel, apts);
+        pos += frame_size;
+      }
+      fifo.erase(fifo.begin(), fifo.begin()+pos);
+      ++ltcframe;
+    }
+    if( !fifo.empty() ){
+      if( ac->frame_size )
+        fifo.resize(frame_size, 0.0f);
+      write_audio(oc, ast, &(fifo[0]), fifo.size(), ltc_channel, apts);
+    }
+    // flush delayed packets:
+    AVStream* sts[2] = { vst, ast };
+    for(uint32_t s=0;s<2;++s){
+      int got_packet(sts[s]->codec->codec->capabilities & CODEC_CAP_DELAY);
+      while( got_packet ){
+        AVPacket pkt;
+        av_init_packet(&pkt);
+        pkt.data = NULL;
+        pkt.size = 0;
+        int err((s == 0) ? avcodec_encode_video2(sts[s]->codec, &pkt, NULL, &got_packet) :
+                avcodec_encode_audio2(sts[s]->codec, &pkt, NULL, &got_packet));
+        if( err < 0 )
+          throw error_msg_t(__FILE__,__LINE__,"Error while encoding.");
+        if( got_packet )
+          write_packet(oc, sts[s], &pkt);
+      }
+    }
+    av_write_trailer(oc);
+  }
+  catch( ... ){
+    if( ltcenc )
+      ltc_encoder_free(ltcenc);
+    for(uint32_t s=0;s<oc->nb_streams;++s)
+      avcodec_close(oc->streams[s]->codec);
+    if( oc->pb )
+      avio_close(oc->pb);
+    avformat_free_context(oc);
+    throw;
+  }
+  ltc_encoder_free(ltcenc);
+  for(uint32_t s=0;s<oc->nb_streams;++s)
+    avcodec_close(oc->streams[s]->codec);
+  avio_close(oc->pb);
+  avformat_free_context(oc);
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,86 @@
+/*
+  ltcgen - generate test files with LTC in the audio track
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LTCGEN_H
+#define LTCGEN_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+
+#include <libavutil/samplefmt.h>
+#include <libavformat/avformat.h>
+
+}
+
+/**
+   Discontinuity of the LTC.
+ */
+class ltcgen_jump_t {
+public:
+  // first video frame after the jump:
+  uint32_t frame;
+  // LTC frames skipped (negative: LTC goes back):
+  int32_t delta;
+};
+
+/**
+   Generator of test files with a small video stream and LTC in one
+   channel of an audio stream.
+
+   The audio codec is PCM in the requested sample format, except for
+   planar float, which is produced by the AAC decoder; in that case
+   the audio is AAC encoded. The video is raw, or MPEG-4 with B-frames
+   (packets out of presentation order).
+ */
+class ltcgen_t {
+public:
+  ltcgen_t();
+  /**
+     Write a test file; the container format is deduced from the file
+     name, e.g. "test.nut".
+   */
+  void write(const std::string& filename) const;
+  // integer frame rates only, the LTC frame numbers are not drop frame:
+  uint32_t fps;
+  AVSampleFormat sample_fmt;
+  uint32_t channels;
+  uint32_t ltc_channel;
+  uint32_t sample_rate;
+  // consecutive B-frames of the MPEG-4 video, 0: raw video:
+  uint32_t bframes;
+  // video frames per LTC frame, the video frame rate is fps*fstep:
+  uint32_t fstep;
+  // duration in seconds:
+  double duration;
+  // LTC frame number of the first video frame:
+  uint32_t start_frame;
+  // LTC jumps, sorted by video frame:
+  std::vector<ltcgen_jump_t> jumps;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
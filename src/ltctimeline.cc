@@ -0,0 +1,127 @@
+/*
+  flat timeline of decoded LTC frames
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "ltctimeline.h"
+#include <algorithm>
+
+static bool entry_less(const ltc_timeline_t::entry_t& e, int64_t pos)
+{
+  return e.off_end < pos;
+}
+
+static bool pos_less(int64_t pos, const ltc_timeline_t::entry_t& e)
+{
+  return pos < e.off_end;
+}
+
+ltc_timeline_t::ltc_timeline_t()
+  : offset(0),
+    first(0)
+{
+}
+
+void ltc_timeline_t::add(int64_t off_end, uint32_t frame)
+{
+  entry_t e;
+  e.off_end = off_end;
+  e.frame = frame;
+  if( empty() || (entries.back().off_end < off_end) ){
+    entries.push_back(e);
+    return;
+  }
+  std::vector<entry_t>::iterator it(std::lower_bound(entries.begin()+(first-offset),entries.end(),off_end,entry_less));
+  if( (it != entries.end()) && (it->off_end == off_end) )
+    it->frame = frame;
+  else
+    entries.insert(it,e);
+}
+
+void ltc_timeline_t::append(const ltc_timeline_t& src, size_t from, size_t to)
+{
+  for(size_t k=from;k<to;++k)
+    add(src[k].off_end,src[k].frame);
+}
+
+size_t ltc_timeline_t::lower_bound(int64_t pos) const
+{
+  return offset+(std::lower_bound(entries.begin()+(first-offset),entries.end(),pos,entry_less)-entries.begin());
+}
+
+size_t ltc_timeline_t::upper_bound(int64_t pos) const
+{
+  return offset+(std::upper_bound(entries.begin()+(first-offset),entries.end(),pos,pos_less)-entries.begin());
+}
+
+void ltc_timeline_t::discard_before(int64_t pos)
+{
+  first = std::max(first,lower_bound(pos));
+  // compact when more than half of the storage is unused, which keeps
+  // the cost per entry constant:
+  if( 2*(first-offset) > entries.size() ){
+    entries.erase(entries.begin(),entries.begin()+(first-offset));
+    offset = first;
+  }
+}
+
+ltc_cursor_t::ltc_cursor_t(const ltc_timeline_t& timeline)
+  : tl(timeline),
+    lpos(0),
+    lquery(INT64_MIN),
+    upos(0),
+    uquery(INT64_MIN)
+{
+}
+
+void ltc_cursor_t::reset()
+{
+  lpos = 0;
+  lquery = INT64_MIN;
+  upos = 0;
+  uquery = INT64_MIN;
+}
+
+size_t ltc_cursor_t::lower_bound(int64_t pos)
+{
+  if( (pos < lquery) || (lpos < tl.begin()) ){
+    lpos = tl.lower_bound(pos);
+  }else{
+    while( (lpos < tl.size()) && (tl[lpos].off_end < pos) )
+      ++lpos;
+  }
+  lquery = pos;
+  return lpos;
+}
+
+size_t ltc_cursor_t::upper_bound(int64_t pos)
+{
+  if( (pos < uquery) || (upos < tl.begin()) ){
+    upos = tl.upper_bound(pos);
+  }else{
+    while( (upos < tl.size()) && (tl[upos].off_end <= pos) )
+      ++upos;
+  }
+  uquery = pos;
+  return upos;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
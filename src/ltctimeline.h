@@ -0,0 +1,114 @@
+/*
+  flat timeline of decoded LTC frames
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LTCTIMELINE_H
+#define LTCTIMELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+   LTC frame numbers as a function of the audio sample position of
+   the frame end, sorted by sample position.
+
+   LTC frames are decoded in increasing order of their end position,
+   thus adding a frame is an append in the normal case.
+
+   Entries are addressed by a running index. In streaming mode, old
+   entries can be discarded from the front; the index of the
+   remaining entries does not change.
+ */
+class ltc_timeline_t {
+public:
+  ltc_timeline_t();
+  struct entry_t {
+    int64_t off_end;
+    uint32_t frame;
+  };
+  /**
+     Add a frame; a frame with the same end position is replaced.
+   */
+  void add(int64_t off_end, uint32_t frame);
+  /**
+     Append a range of entries of another timeline (used for merging).
+   */
+  void append(const ltc_timeline_t& src, size_t from, size_t to);
+  /**
+     Index of the first entry ending at or after 'pos', or size().
+   */
+  size_t lower_bound(int64_t pos) const;
+  /**
+     Index of the first entry ending after 'pos', or size().
+   */
+  size_t upper_bound(int64_t pos) const;
+  /**
+     Discard all entries ending before 'pos'.
+   */
+  void discard_before(int64_t pos);
+  /**
+     Index of the first entry which was not discarded.
+   */
+  size_t begin() const { return first; };
+  const entry_t& operator[](size_t k) const { return entries[k-offset]; };
+  const entry_t& back() const { return entries.back(); };
+  size_t size() const { return offset+entries.size(); };
+  bool empty() const { return size() == first; };
+  void clear() { entries.clear(); offset = first = 0; };
+  void reserve(size_t n) { entries.reserve(n); };
+private:
+  std::vector<entry_t> entries;
+  // index of entries[0]:
+  size_t offset;
+  // index of the first valid entry:
+  size_t first;
+};
+
+/**
+   Merge-join lookup in a timeline for increasing query positions.
+
+   The cursor moves forward from the previous result, which is
+   amortized constant time for monotonic queries. Queries which go
+   backwards (e.g., B-frame reordering) fall back to a binary search.
+   The timeline may grow between queries.
+ */
+class ltc_cursor_t {
+public:
+  ltc_cursor_t(const ltc_timeline_t& timeline);
+  /**
+     Forget the previous query, e.g. after the timeline was replaced.
+   */
+  void reset();
+  size_t lower_bound(int64_t pos);
+  size_t upper_bound(int64_t pos);
+private:
+  const ltc_timeline_t& tl;
+  size_t lpos;
+  int64_t lquery;
+  size_t upos;
+  int64_t uquery;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
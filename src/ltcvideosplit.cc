@@ -20,430 +20,288 @@
 #include <iostream>
 #include "error.h"
 #include <vector>
-#include <map>
-#include <ltc.h>
 #include <getopt.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include <set>
+#include <fstream>
+#include <sstream>
+#include "workerpool.h"
+#include "ltccache.h"
+#include "decoder.h"
+#include "mmapio.h"
+#include "timeline.h"
 
-extern "C" {
-
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-  //#include <libswscale/swscale.h>
-
+void app_usage(const std::string& app_name,struct option * opt,const std::string& app_arg = "")
+{
+  std::cout << "Usage:\n\n" << app_name << " [options] " << app_arg << "\n\nOptions:\n\n";
+  while( opt->name ){
+    std::cout << "  -" << (char)(opt->val) << " " << (opt->has_arg?"#":"") <<
+      "\n  --" << opt->name << (opt->has_arg?"=#":"") << "\n\n";
+    opt++;
+  }
+  std::cout << std::endl;
 }
 
-//#include "writevideo.h"
-
-#define LTC_QUEUE_LENGTH 160000
-#define SAMPLEBUFFERSIZE 2^17
 
-class decoder_t 
-{
+class options_t {
 public:
-  decoder_t(const std::string& filename, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t channel, uint32_t fstep_);
-  ~decoder_t();
-  void scan_frame_map();
-  void sort_frames();
-private:
-  bool readframe();
-  bool readframe_sort();
-  void process_video(AVPacket* packet);
-  void process_audio(AVPacket* packet);
-  void process_video_sort(AVPacket* packet);
-  AVCodecContext* open_decoder(AVCodecContext*);
-  void ff_compute_frame_duration(AVStream *st);
-  std::string fname;
-  AVFormatContext* pFormatCtx;
-  AVCodecContext* pCodecCtxVideo;
-  AVCodecContext* pCodecCtxAudio;
-  AVFrame *pVideoFrame;
-  AVFrame *pAudioFrame;
-  int videoStream;
-  int audioStream;
-  uint32_t frameno;
-  // list of PTS in audio samples, from video codec:
-  std::vector<int64_t> video_frame_ends;
-  // map of LTC frame numbers as function of audio samples:
-  std::map<int64_t,uint32_t> ltc_frame_ends;
-  LTCDecoder *ltcdecoder;
-  int fps_den;
-  int fps_num;
-  uint32_t frame_duration;
-  uint32_t ltc_posinfo;
-  uint8_t* samplebuffer;
-  uint32_t current_frame;
-  uint32_t current_inframe;
+  options_t();
   double audiofps;
-  std::set<uint32_t> decodeframes_;
-  uint32_t channel_;
-  //writevideo_t* wrt;
-public:
-  bool b_list;
+  std::set<uint32_t> decodeframes;
+  uint32_t channel;
   uint32_t fstep;
-  // step decrement variable:
-  uint32_t fstepdec;
+  bool offsetlist;
+  bool singlepass;
+  bool audioonly;
+  uint32_t nchunks;
+  bool b_cache;
+  std::string cachedir;
+  bool streaming;
+  // follow mode: stop after this time without growth, in seconds:
+  double follow;
+  double probe;
+  bool split;
+  bool smartrender;
+  uint32_t exportjobs;
+  bool stats;
+  bool pipeline;
+  uint32_t decimate;
+  bool autochannel;
+  bool allchannels;
+  std::string framemap;
 };
 
-void decoder_t::scan_frame_map()
+options_t::options_t()
+  : audiofps(0),
+    channel(0),
+    fstep(1),
+    offsetlist(false),
+    singlepass(false),
+    audioonly(false),
+    nchunks(1),
+    b_cache(false),
+    streaming(false),
+    follow(0),
+    probe(0),
+    split(false),
+    smartrender(false),
+    exportjobs(1),
+    stats(false),
+    pipeline(false),
+    decimate(1),
+    autochannel(false),
+    allchannels(false)
 {
-  while( readframe() );
 }
 
-void decoder_t::sort_frames()
-{
-  av_seek_frame(pFormatCtx,videoStream,0,AVSEEK_FLAG_FRAME);
-  while( readframe_sort() );
-}
+/**
+   Align one video file.
 
-void convert_audio_samples(ltcsnd_sample_t* outbuffer, uint8_t** inbuffer, uint32_t size, uint32_t channels, AVSampleFormat fmt, uint32_t channel)
+   Results are written to 'out', diagnostics and errors to 'log'.
+   If 'clips' is not NULL, the sync segments are appended to it as
+   clips on the LTC timeline. Returns false on error.
+ */
+bool process_file(const std::string& filename, const options_t& opts, std::ostream& out, std::ostream& log, std::vector<clip_t>* clips = NULL)
 {
-  switch( fmt ){
-  case AV_SAMPLE_FMT_S16P : 
-    {
-      int16_t* lbuf((int16_t*)(inbuffer[channel]));
-      for(uint32_t k=0;k<size;++k){
-        outbuffer[k] = 128+0.00387573*lbuf[k];
-      }
-      break;
+  try{
+    std::string cachefile;
+    file_id_t id;
+    bool b_regular(false);
+    struct stat st;
+    if( stat(filename.c_str(),&st) == 0 )
+      b_regular = S_ISREG(st.st_mode);
+    bool b_multichannel(opts.autochannel || opts.allchannels);
+    if( opts.b_cache && b_regular ){
+      cachefile = ltc_cache_t::cachefile(filename,opts.cachedir);
+      id = file_id_t(filename);
     }
-  case AV_SAMPLE_FMT_S16 : 
-    {
-      int16_t* lbuf((int16_t*)(inbuffer[0]));
-      for(uint32_t k=0;k<size;++k){
-        outbuffer[k] = 128+0.00387573*lbuf[k*channels+channel];
+    if( !cachefile.empty() && !opts.split && opts.decodeframes.empty() && !b_multichannel ){
+      ltc_cache_t cache;
+      if( cache.load(cachefile,id,opts.channel) ){
+        decoder_t dec(cache,opts.audiofps,opts.decodeframes,opts.fstep,out,log);
+        dec.b_list = opts.offsetlist;
+        dec.stats.b_enabled = opts.stats;
+        dec.b_framemap = !opts.framemap.empty();
+        dec.b_timeline = (clips != NULL);
+        dec.sort_frames();
+        if( dec.b_framemap )
+          dec.write_framemap(opts.framemap);
+        if( clips )
+          dec.get_clips(*clips);
+        if( opts.stats )
+          dec.stats.write_json(log,filename);
+        return true;
       }
-      break;
-    }
-  case AV_SAMPLE_FMT_U8 : 
-    {
-      uint8_t* lbuf((uint8_t*)inbuffer);
-      for(uint32_t k=0;k<size;++k)
-        outbuffer[k] = lbuf[k*channels+channel];
-      break;
     }
-  case AV_SAMPLE_FMT_S32 :
-    {
-      int32_t* lbuf((int32_t*)(inbuffer[0]));
-      for(uint32_t k=0;k<size;++k)
-        outbuffer[k] = 128+5.9139e-08*lbuf[k*channels+channel];
-      break;
-    }
-  case AV_SAMPLE_FMT_FLT :
-    {
-      float* lbuf((float*)(inbuffer[0]));
-      for(uint32_t k=0;k<size;++k)
-        outbuffer[k] = 128+127*lbuf[k*channels+channel];
-      break;
-    }
-  case AV_SAMPLE_FMT_FLTP : 
-    {
-      float* lbuf((float*)(inbuffer[channel]));
-      for(uint32_t k=0;k<size;++k){
-        outbuffer[k] = 128+127*lbuf[k];
+    decoder_t dec((filename=="-")?"pipe:0":filename,opts.audiofps,opts.decodeframes,opts.channel,opts.fstep,out,log);
+    dec.b_list = opts.offsetlist;
+    dec.b_audioonly = opts.audioonly;
+    // decimated LTC positions are approximate and are not cached:
+    dec.b_keep_records = opts.b_cache && b_regular && !opts.allchannels && (opts.decimate <= 1);
+    dec.b_split = opts.split;
+    dec.b_smartrender = opts.smartrender;
+    dec.exportjobs = opts.exportjobs;
+    dec.stats.b_enabled = opts.stats;
+    dec.b_pipeline = opts.pipeline;
+    dec.set_decimation(opts.decimate);
+    dec.b_framemap = !opts.framemap.empty();
+    dec.b_timeline = (clips != NULL);
+    if( opts.allchannels && clips )
+      throw error_msg_t(__FILE__,__LINE__,"A timeline cannot be built when reporting all channels.");
+    if( b_multichannel ){
+      if( opts.streaming || (opts.follow > 0) || !dec.is_seekable() || (opts.probe > 0) || (opts.nchunks > 1) || opts.singlepass )
+        throw error_msg_t(__FILE__,__LINE__,"Decoding all channels requires the default two-pass mode.");
+      if( opts.allchannels && opts.split ){
+        log << "Warning: cannot split when reporting all channels.\n";
+        dec.b_split = false;
       }
-      break;
-    }
-  default:
-    throw error_msg_t(__FILE__,__LINE__,"Unsupported sample format \"%s\".",
-                      av_get_sample_fmt_name( fmt ) );
-  }
-}
-
-void decoder_t::ff_compute_frame_duration(AVStream *st)
-{
-  if( st->codec->codec_type != AVMEDIA_TYPE_VIDEO )
-    return;
-  if (st->avg_frame_rate.num) {
-    fps_num = st->avg_frame_rate.den;
-    fps_den = st->avg_frame_rate.num;
-  } else if(st->time_base.num*1000LL > st->time_base.den) {
-    fps_num = st->time_base.num;
-    fps_den = st->time_base.den;
-  }else if(st->codec->time_base.num*1000LL > st->codec->time_base.den){
-    fps_num = st->codec->time_base.num;
-    fps_den = st->codec->time_base.den;
-    if (st->parser && st->parser->repeat_pict) {
-      if (fps_num > INT_MAX / (1 + st->parser->repeat_pict))
-        fps_den /= 1 + st->parser->repeat_pict;
-      else
-        fps_num *= 1 + st->parser->repeat_pict;
-    }
-    //If this codec can be interlaced or progressive then we need a parser to compute duration of a packet
-    //Thus if we have no parser in such case leave duration undefined.
-    if(st->codec->ticks_per_frame>1 && !st->parser){
-      fps_num = fps_den = 0;
-    }
-  }
-}
-
-AVCodecContext* decoder_t::open_decoder(AVCodecContext* pCodecCtxOrig)
-{
-  // Find the decoder for the video stream
-  AVCodec* pCodec( avcodec_find_decoder( pCodecCtxOrig->codec_id ) );
-  if( !pCodec )
-    throw error_msg_t(__FILE__,__LINE__,"Unsupported codec %d.", pCodecCtxOrig->codec_id);
-  // Copy context
-  AVCodecContext* pCodecCtx( avcodec_alloc_context3( pCodec ) );
-  if( avcodec_copy_context( pCodecCtx, pCodecCtxOrig ) != 0) 
-    throw error_msg_t(__FILE__,__LINE__,"Couldn't copy codec context.");
-  // Open codec
-  if( avcodec_open2( pCodecCtx, pCodec, NULL ) < 0 )
-    throw error_msg_t(__FILE__,__LINE__,"Couldn't open codec for %s.",pCodec->long_name);
-  return pCodecCtx;
-}
-
-decoder_t::decoder_t(const std::string& filename, double audiofps_, const std::set<uint32_t>& decodeframes, uint32_t channel, uint32_t fstep_)
-  : fname(filename),
-    pFormatCtx(NULL),pCodecCtxVideo(NULL),pCodecCtxAudio(NULL),
-    //pVideoFrame(av_frame_alloc()),
-    pVideoFrame(avcodec_alloc_frame()),
-    //pAudioFrame(av_frame_alloc()),
-    pAudioFrame(avcodec_alloc_frame()),
-    videoStream(-1),
-    audioStream(-1),
-    frameno(0),
-    ltcdecoder(NULL),
-    fps_den(0),
-    fps_num(0),
-    ltc_posinfo(0),
-    samplebuffer(new uint8_t[SAMPLEBUFFERSIZE]),
-    current_frame(0),
-    current_inframe(0),
-    audiofps(audiofps_),
-  decodeframes_(decodeframes),
-  channel_(channel),
-  b_list(false),
-  fstep(fstep_),
-  fstepdec(0)
-{
-  int averr(0);
-  if((averr = avformat_open_input(&pFormatCtx, filename.c_str(), NULL, NULL)) < 0){
-    char averrs[1024];
-    av_strerror(averr,averrs,1024);
-    averrs[1023] = '\0';
-    throw error_msg_t(__FILE__,__LINE__,"Unable to open video file \"%s\" (%s).",filename.c_str(),averrs);
-
-  }
-  try{
-    // Retrieve stream information
-    if( avformat_find_stream_info( pFormatCtx, NULL) < 0 )
-      throw error_msg_t(__FILE__,__LINE__,"Unable to retrieve stream information in video file \"%s\".",filename.c_str());
-
-    // Find the first video stream:
-    for(uint32_t i=0; i<pFormatCtx->nb_streams; i++)
-      if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO) {
-        videoStream=i;
-        break;
+      if( opts.allchannels && dec.b_framemap ){
+        log << "Warning: cannot write a frame map when reporting all channels.\n";
+        dec.b_framemap = false;
       }
-    // Find first audio stream:
-    for(uint32_t i=0; i<pFormatCtx->nb_streams; i++)
-      if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_AUDIO) {
-        audioStream=i;
-        break;
+      dec.decode_all_channels();
+      dec.scan_frame_map();
+      if( opts.allchannels ){
+        dec.sort_all_channels();
+      }else{
+        dec.select_channel();
+        dec.sort_frames();
       }
-    if(videoStream==-1)
-      throw error_msg_t(__FILE__,__LINE__,"No video stream found in file \"%s\".",filename.c_str());
-    if(audioStream==-1)
-      throw error_msg_t(__FILE__,__LINE__,"No audio stream found in file \"%s\".",filename.c_str());
-    pCodecCtxVideo = open_decoder( pFormatCtx->streams[videoStream]->codec );
-    pCodecCtxAudio = open_decoder( pFormatCtx->streams[audioStream]->codec );
-    ff_compute_frame_duration(pFormatCtx->streams[videoStream]);
-    if( !fps_num )
-      throw error_msg_t(__FILE__,__LINE__,"Invalid frame rate (0).");
-    if( !b_list ){
-      std::cerr << "fps: " << fps_den << "/" << fps_num << "\n";
+    }else if( opts.streaming || (opts.follow > 0) || !dec.is_seekable() ){
+      if( opts.split )
+        log << "Warning: cannot split non-seekable input.\n";
+      if( !opts.decodeframes.empty() )
+        log << "Warning: cannot decode frames of non-seekable input.\n";
+      dec.b_split = false;
+      // the cache is not written in streaming mode, and memory must
+      // not grow with the stream length:
+      dec.b_keep_records = false;
+      if( opts.follow > 0 ){
+        dec.scan_follow(opts.follow);
+      }else{
+        dec.scan_stream();
+      }
+      if( dec.b_framemap )
+        dec.write_framemap(opts.framemap);
+      if( clips )
+        dec.get_clips(*clips);
+      if( opts.stats )
+        dec.stats.write_json(log,filename);
+      return true;
+    }else if( opts.probe > 0 ){
+      dec.b_keep_records = false;
+      dec.scan_probe(opts.probe);
+    }else if( opts.nchunks > 1 ){
+      dec.scan_frame_map_parallel(opts.nchunks);
+      dec.sort_frames();
+    }else if( opts.singlepass ){
+      dec.scan_and_sort();
+    }else{
+      dec.scan_frame_map();
+      dec.sort_frames();
     }
-    frame_duration = fps_num*pCodecCtxAudio->time_base.den/fps_den/pCodecCtxAudio->time_base.num;
-    avcodec_default_get_buffer(pCodecCtxAudio, pAudioFrame );
-    ltcdecoder = ltc_decoder_create(pCodecCtxAudio->sample_rate * pCodecCtxVideo->time_base.den / std::max(pCodecCtxVideo->time_base.num,1), LTC_QUEUE_LENGTH);
-  }
-  catch( ... ){
-    avformat_close_input(&pFormatCtx);
-    throw;
-  }
-}
-
-decoder_t::~decoder_t()
-{
-  //if( wrt )
-  //  delete wrt;
-  delete [] samplebuffer;
-  avformat_close_input(&pFormatCtx);
-}
-
-bool decoder_t::readframe()
-{
-  AVPacket packet;
-  av_init_packet( &packet );
-  if( av_read_frame( pFormatCtx, &packet ) >= 0 ){
-    if( packet.stream_index == videoStream ){
-      process_video( &packet );
-    }else if( packet.stream_index == audioStream ) {
-      process_audio( &packet );
+    if( opts.stats )
+      dec.stats.write_json(log,filename);
+    if( dec.b_framemap )
+      dec.write_framemap(opts.framemap);
+    if( clips )
+      dec.get_clips(*clips);
+    dec.write_segments();
+    dec.extract_frames();
+    if( dec.b_keep_records ){
+      ltc_cache_t cache;
+      cache.id = id;
+      dec.get_cache(cache);
+      cache.save(cachefile);
     }
-    av_free_packet( &packet );
     return true;
   }
-  return false;
-}
-
-bool decoder_t::readframe_sort()
-{
-  AVPacket packet;
-  av_init_packet( &packet );
-  if( av_read_frame( pFormatCtx, &packet ) >= 0 ){
-    if( packet.stream_index == videoStream ){
-      process_video_sort( &packet );
-    }
-    av_free_packet( &packet );
-    return true;
+  catch( const std::exception& e ){
+    log << "Error: " << e.what() << "\n";
+    return false;
   }
-  return false;
-}
-
-void decoder_t::process_video(AVPacket* packet)
-{
-  video_frame_ends.push_back( packet->pts * 
-                              pFormatCtx->streams[videoStream]->time_base.num * 
-                              pCodecCtxAudio->time_base.den /
-                              pFormatCtx->streams[videoStream]->time_base.den / 
-                              pCodecCtxAudio->time_base.num );
-  //DEBUG(video_frame_ends.back());
-}
-
-int save_frame_as_jpeg(AVCodecContext *pCodecCtx, AVFrame *pFrame, int FrameNo) {
-    AVCodec *jpegCodec = avcodec_find_encoder(AV_CODEC_ID_JPEG2000);
-    if (!jpegCodec) {
-        return -1;
-    }
-    AVCodecContext *jpegContext = avcodec_alloc_context3(jpegCodec);
-    if (!jpegContext) {
-        return -1;
-    }
-
-    jpegContext->pix_fmt = pCodecCtx->pix_fmt;
-    jpegContext->height = pFrame->height;
-    jpegContext->width = pFrame->width;
-
-    if (avcodec_open2(jpegContext, jpegCodec, NULL) < 0) {
-        return -1;
-    }
-    FILE *JPEGFile;
-    char JPEGFName[256];
-
-    AVPacket packet;
-    memset(&packet,0,sizeof(packet));
-    av_init_packet(&packet);
-    int gotFrame;
-
-    if (avcodec_encode_video2(jpegContext, &packet, pFrame, &gotFrame) < 0) {
-        return -1;
-    }
-
-    sprintf(JPEGFName, "dvr-%06d.jpg", FrameNo);
-    JPEGFile = fopen(JPEGFName, "wb");
-    fwrite(packet.data, 1, packet.size, JPEGFile);
-    fclose(JPEGFile);
-
-    av_free_packet(&packet);
-    avcodec_close(jpegContext);
-    return 0;
 }
 
-void decoder_t::process_video_sort(AVPacket* packet)
-{
-  if( fstepdec )
-    fstepdec--;
-  if( !fstepdec ){
-    fstepdec = fstep;
-    uint64_t aframe( packet->pts * 
-                     pFormatCtx->streams[videoStream]->time_base.num * 
-                     pCodecCtxAudio->time_base.den /
-                     pFormatCtx->streams[videoStream]->time_base.den / 
-                     pCodecCtxAudio->time_base.num );
-    std::map<int64_t,uint32_t>::iterator lbound( ltc_frame_ends.lower_bound(aframe) );
-    std::map<int64_t,uint32_t>::iterator ubound( ltc_frame_ends.upper_bound(aframe-frame_duration) );
-    if( (lbound != ltc_frame_ends.end()) && (ubound != ltc_frame_ends.end()) && (lbound->second == ubound->second+1) ){
-      if( current_frame != lbound->second ){
-        current_frame = lbound->second;
-        char fname_new[fname.size()+32];
-        sprintf( fname_new, "%s.%05d", fname.c_str(), current_frame );
-        int delta_frame((int)current_frame - (int)current_inframe);
-        delta_frame *= fstep;
-        int delta_frame_abs(abs(delta_frame));
-        int delta_sec(delta_frame_abs*fps_num/fps_den);
-        char stime[32];
-        memset(stime,0,32);
-        sprintf( stime, "%c%02d:%02d:%02d.%02d %1.4fs/%d samples",(delta_frame<0)?'-':'+',delta_sec/3600,(delta_sec/60)%60,delta_sec%60,(delta_frame_abs*fps_num)%fps_den, (double)((int)aframe-(int)(lbound->first))/(pCodecCtxAudio->sample_rate), (int)aframe-(int)(lbound->first) );
-        if( b_list ){
-          std::cout << current_inframe*fstep << " " << current_frame*fstep << " " << delta_frame << std::endl;
-        }else{
-          std::cout << current_inframe*fstep << " -> " << current_frame*fstep << " (" << 
-            delta_frame << " " << stime << ")" << std::endl;
-        }
-      }
-    }
-    current_frame++;
-    current_inframe++;
-  }
-}
+/**
+   Align several files (cameras) to one LTC timeline.
 
-void decoder_t::process_audio(AVPacket* packet)
+   The files are decoded in parallel; the placement of each clip on
+   the timeline and the overlaps of all camera pairs are written to
+   'out'. Returns false if a file could not be decoded.
+ */
+bool process_timeline(const std::vector<std::string>& filenames, const options_t& opts, uint32_t nthreads, std::ostream& out, std::ostream& log)
 {
-  // first, decode audio frame from video:
-  int got_frame(0);
-  avcodec_get_frame_defaults( pAudioFrame );
-  uint32_t len(avcodec_decode_audio4(pCodecCtxAudio, pAudioFrame, &got_frame, packet));
-  if (len < 0) {
-    fprintf(stderr, "Error while decoding\n");
-    exit(1);
+  ordered_writer_t writer(filenames.size(),out,log);
+  std::vector<std::vector<clip_t> > clips(filenames.size());
+  std::vector<char> success(filenames.size(),false);
+  {
+    worker_pool_t pool(std::min(nthreads,(uint32_t)filenames.size()));
+    for(uint32_t k=0;k<filenames.size();++k)
+      pool.add([&,k](){
+          // the offsets of the single files are not reported:
+          std::ostringstream fout;
+          std::ostringstream flog;
+          success[k] = process_file(filenames[k],opts,fout,flog,&(clips[k]));
+          writer.set(k,"",flog.str());
+        });
+    pool.wait();
   }
-  // now decode LTC from audio:
-  if (got_frame) {
-    ltcsnd_sample_t ltcsamples[pAudioFrame->nb_samples];
-    convert_audio_samples(ltcsamples, pAudioFrame->data, pAudioFrame->nb_samples, pCodecCtxAudio->channels, pCodecCtxAudio->sample_fmt,channel_);
-    ltc_decoder_write(ltcdecoder, ltcsamples, pAudioFrame->nb_samples, ltc_posinfo);
-    ltc_posinfo += pAudioFrame->nb_samples;
-    LTCFrameExt ltcframe;
-    while (ltc_decoder_read(ltcdecoder,&ltcframe)) {
-      SMPTETimecode stime;
-      ltc_frame_to_time(&stime, &ltcframe.ltc, false );
-      uint64_t fno(stime.frame+fps_den*(stime.secs+stime.mins*60+stime.hours*3600)/(fps_num*fstep));
-      if( audiofps > 0 )
-        fno = stime.frame*fps_den/(audiofps*fps_num)+fps_den*(stime.secs+stime.mins*60+stime.hours*3600)/(fps_num*fstep);
-      // 'ltcframe.off_end' is the audio sample number of the LTC frame end.
-      ltc_frame_ends[ltcframe.off_end] = fno;
+  timeline_t timeline;
+  for(uint32_t k=0;k<filenames.size();++k)
+    for(std::vector<clip_t>::iterator it=clips[k].begin();it!=clips[k].end();++it){
+      it->camera = k;
+      timeline.add(*it);
     }
-  }else{
-    DEBUG("no frame");
-  }
+  timeline.build();
+  timeline.write(out);
+  for(uint32_t k=0;k<success.size();++k)
+    if( !success[k] )
+      return false;
+  return true;
 }
 
-void app_usage(const std::string& app_name,struct option * opt,const std::string& app_arg = "")
+/**
+   Lock manager for libavcodec, required when codecs are opened in
+   several threads.
+ */
+int av_lockmgr(void** mutex, enum AVLockOp op)
 {
-  std::cout << "Usage:\n\n" << app_name << " [options] " << app_arg << "\n\nOptions:\n\n";
-  while( opt->name ){
-    std::cout << "  -" << (char)(opt->val) << " " << (opt->has_arg?"#":"") <<
-      "\n  --" << opt->name << (opt->has_arg?"=#":"") << "\n\n";
-    opt++;
+  switch( op ){
+  case AV_LOCK_CREATE:
+    *mutex = new std::mutex;
+    break;
+  case AV_LOCK_OBTAIN:
+    ((std::mutex*)(*mutex))->lock();
+    break;
+  case AV_LOCK_RELEASE:
+    ((std::mutex*)(*mutex))->unlock();
+    break;
+  case AV_LOCK_DESTROY:
+    delete (std::mutex*)(*mutex);
+    *mutex = NULL;
+    break;
   }
-  std::cout << std::endl;
+  return 0;
 }
 
-
 int main(int argc, char** argv)
 {
+  // text output is written in blocks, not line by line:
+  std::ios_base::sync_with_stdio(false);
   std::cerr << "ltcvideosplit version " << VERSION_MAJOR << "." << VERSION_MINOR << std::endl;
   try{
     if( argc < 2 )
       throw error_msg_t(__FILE__,__LINE__,"Invalid number of arguments %d.",argc-1);
     av_register_all();
-    double audiofps(0);
-    std::string filename("");
-    std::set<uint32_t> decodeframes;
-    uint32_t channel(0);
-    const char *options = "hf:d:c:os:";
+    avformat_network_init();
+    av_lockmgr_register(av_lockmgr);
+    options_t opts;
+    std::vector<std::string> filenames;
+    uint32_t nthreads(1);
+    bool b_timeline(false);
+    const char *options = "hf:d:c:os:1al:j:k:C::SF:p:xre:tPD:Am:I:T";
     struct option long_options[] = { 
       { "help", 0, 0, 'h' },
       { "fps",  1, 0, 'f' },
@@ -451,43 +309,177 @@ int main(int argc, char** argv)
       { "channel", 1, 0, 'c' },
       { "offsetlist", 0, 0, 'o' },
       { "fstep", 1, 0, 's' },
+      { "singlepass", 0, 0, '1' },
+      { "audioonly", 0, 0, 'a' },
+      { "filelist", 1, 0, 'l' },
+      { "jobs", 1, 0, 'j' },
+      { "chunks", 1, 0, 'k' },
+      { "cache", 2, 0, 'C' },
+      { "stream", 0, 0, 'S' },
+      { "follow", 1, 0, 'F' },
+      { "probe", 1, 0, 'p' },
+      { "split", 0, 0, 'x' },
+      { "smartrender", 0, 0, 'r' },
+      { "exportjobs", 1, 0, 'e' },
+      { "stats", 0, 0, 't' },
+      { "pipeline", 0, 0, 'P' },
+      { "decimate", 1, 0, 'D' },
+      { "all-channels", 0, 0, 'A' },
+      { "map", 1, 0, 'm' },
+      { "io", 1, 0, 'I' },
+      { "timeline", 0, 0, 'T' },
       { 0, 0, 0, 0 }
     };
     int opt(0);
     int option_index(0);
-    bool offsetlist(false);
-    int fstep(1);
     while( (opt = getopt_long(argc, argv, options,
                               long_options, &option_index)) != -1){
       switch(opt){
       case 'h':
-        app_usage("ltcvideosplit",long_options,"filename");
-        std::cout << "-f overrides the frame rate embedded in the audio";
+        app_usage("ltcvideosplit",long_options,"filename [filename ...]");
+        std::cout << "-f overrides the frame rate embedded in the audio\n";
+        std::cout << "-d writes video frame # as JPEG image <name>.<frame>.jpg, can be repeated\n";
+        std::cout << "-l reads file names from a file, one per line\n";
+        std::cout << "-j sets the number of files processed in parallel\n";
+        std::cout << "-k splits the audio of each file into chunks decoded in parallel\n";
+        std::cout << "-C stores decoded LTC maps next to the input files, or in the given directory\n";
+        std::cout << "-S forces streaming mode, which is used automatically for non-seekable input;\n"
+          "   use '-' to read from stdin\n";
+        std::cout << "-F follows a file which is still being written, until it did not grow for # seconds\n";
+        std::cout << "-p decodes LTC only every # seconds and searches sync changes by bisection\n";
+        std::cout << "-x writes each sync segment to a separate file, without re-encoding\n";
+        std::cout << "-r splits frame accurately, re-encoding only the frames between cut and next key frame\n";
+        std::cout << "-e sets the number of segments written in parallel\n";
+        std::cout << "-t writes packet counts and the time spent in each decoding stage as JSON to stderr\n";
+        std::cout << "-P reads, decodes audio and decodes LTC in three parallel threads\n";
+        std::cout << "-D decimates the audio by 2 or 4 before LTC decoding (faster, positions within N samples, N = 2 or 4)\n";
+        std::cout << "-c auto decodes all channels and uses the one with the most valid LTC frames\n";
+        std::cout << "-A decodes all channels and reports the sync changes of every channel with LTC\n";
+        std::cout << "-m writes the LTC frame of every video frame to a binary frame map file\n";
+        std::cout << "-I selects the input I/O: default, mmap or read (large reads), see README\n";
+        std::cout << "-T aligns all input files (cameras) to one LTC timeline and writes clip placements and overlaps\n";
         return -1;
       case 'c':
-        channel = atoi(optarg);
+        if( strcmp(optarg,"auto") == 0 )
+          opts.autochannel = true;
+        else
+          opts.channel = atoi(optarg);
+        break;
+      case 'A':
+        opts.allchannels = true;
+        break;
+      case 'm':
+        opts.framemap = optarg;
+        break;
+      case 'I':
+        if( !input_io_select(optarg) )
+          throw error_msg_t(__FILE__,__LINE__,"Invalid I/O mode \"%s\".",optarg);
         break;
       case 'f':
-        audiofps = atof(optarg);
+        opts.audiofps = atof(optarg);
         break;
       case 'd':
-        decodeframes.insert( atoi( optarg ) );
+        opts.decodeframes.insert( atoi( optarg ) );
         break;
       case 's':
-        fstep = atoi(optarg);
+        opts.fstep = atoi(optarg);
         break;
       case 'o':
-        offsetlist = true;
+        opts.offsetlist = true;
+        break;
+      case '1':
+        opts.singlepass = true;
+        break;
+      case 'a':
+        opts.audioonly = true;
+        break;
+      case 'l':
+        {
+          std::ifstream flist(optarg);
+          if( !flist.good() )
+            throw error_msg_t(__FILE__,__LINE__,"Unable to read file list \"%s\".",optarg);
+          std::string line;
+          while( std::getline(flist,line) )
+            if( !line.empty() )
+              filenames.push_back(line);
+        }
+        break;
+      case 'j':
+        nthreads = std::max(1,atoi(optarg));
+        break;
+      case 'k':
+        opts.nchunks = std::max(1,atoi(optarg));
+        break;
+      case 'p':
+        opts.probe = atof(optarg);
+        break;
+      case 'x':
+        opts.split = true;
+        break;
+      case 'r':
+        opts.split = true;
+        opts.smartrender = true;
+        break;
+      case 'e':
+        opts.exportjobs = std::max(1,atoi(optarg));
+        break;
+      case 't':
+        opts.stats = true;
+        break;
+      case 'P':
+        opts.pipeline = true;
+        break;
+      case 'D':
+        opts.decimate = atoi(optarg);
+        break;
+      case 'T':
+        b_timeline = true;
+        break;
+      case 'S':
+        opts.streaming = true;
+        break;
+      case 'F':
+        opts.follow = atof(optarg);
+        break;
+      case 'C':
+        opts.b_cache = true;
+        if( optarg )
+          opts.cachedir = optarg;
         break;
       }
     }
-    if( optind < argc )
-      filename = argv[optind++];
-    
-    decoder_t dec(filename,audiofps,decodeframes,channel,fstep);
-    dec.b_list = offsetlist;
-    dec.scan_frame_map();
-    dec.sort_frames();
+    while( optind < argc )
+      filenames.push_back(argv[optind++]);
+    if( filenames.empty() )
+      throw error_msg_t(__FILE__,__LINE__,"No input file.");
+    if( (filenames.size() > 1) && !opts.framemap.empty() )
+      throw error_msg_t(__FILE__,__LINE__,"A frame map can be written for a single input file only.");
+    if( b_timeline )
+      return process_timeline(filenames,opts,nthreads,std::cout,std::cerr) ? 0 : 1;
+    if( filenames.size() == 1 ){
+      if( !process_file(filenames[0],opts,std::cout,std::cerr) )
+        return 1;
+      return 0;
+    }
+    // batch mode: one decoder per file, results are written in the
+    // order of the input files:
+    ordered_writer_t writer(filenames.size(),std::cout,std::cerr);
+    std::vector<char> success(filenames.size(),false);
+    {
+      worker_pool_t pool(std::min(nthreads,(uint32_t)filenames.size()));
+      for(uint32_t k=0;k<filenames.size();++k)
+        pool.add([&,k](){
+            std::ostringstream out;
+            std::ostringstream log;
+            out << "# " << filenames[k] << "\n";
+            success[k] = process_file(filenames[k],opts,out,log);
+            writer.set(k,out.str(),log.str());
+          });
+      pool.wait();
+    }
+    for(uint32_t k=0;k<success.size();++k)
+      if( !success[k] )
+        return 1;
     return 0;
   }
   catch( const std::exception& e ){
@@ -0,0 +1,199 @@
+/*
+  ltcvs - C interface of the ltcvideosplit library
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "ltcvs.h"
+#include "decoder.h"
+#include "error.h"
+#include <new>
+#include <mutex>
+#include <ostream>
+
+/**
+   Handle: the decoder and the forwarding of its events to the
+   callbacks.
+ */
+struct ltcvs_t : public decoder_events_t {
+  ltcvs_t();
+  ~ltcvs_t();
+  void sync_change(uint32_t inframe, uint32_t ltcframe, int32_t delta, int64_t offset);
+  void ltc_frame(const ltc_record_t& rec, uint32_t frame);
+  int fail(const char* msg);
+  // text output of the decoder is discarded (no stream buffer):
+  std::ostream null_out;
+  decoder_t* dec;
+  bool b_push;
+  ltcvs_sync_cb_t sync_cb;
+  ltcvs_ltc_cb_t ltc_cb;
+  void* userdata;
+  std::string error;
+};
+
+ltcvs_t::ltcvs_t()
+  : null_out(NULL),
+    dec(NULL),
+    b_push(false),
+    sync_cb(NULL),
+    ltc_cb(NULL),
+    userdata(NULL)
+{
+}
+
+ltcvs_t::~ltcvs_t()
+{
+  delete dec;
+}
+
+void ltcvs_t::sync_change(uint32_t inframe, uint32_t ltcframe, int32_t delta, int64_t offset)
+{
+  if( !sync_cb )
+    return;
+  ltcvs_sync_t s;
+  s.inframe = inframe;
+  s.ltcframe = ltcframe;
+  s.delta = delta;
+  s.offset = offset;
+  sync_cb(userdata,&s);
+}
+
+void ltcvs_t::ltc_frame(const ltc_record_t& rec, uint32_t frame)
+{
+  if( !ltc_cb )
+    return;
+  ltcvs_ltc_t l;
+  l.off_start = rec.off_start;
+  l.off_end = rec.off_end;
+  l.frame = frame;
+  l.hours = rec.tc.hours;
+  l.mins = rec.tc.mins;
+  l.secs = rec.tc.secs;
+  l.frames = rec.tc.frame;
+  ltc_cb(userdata,&l);
+}
+
+int ltcvs_t::fail(const char* msg)
+{
+  error = msg;
+  return -1;
+}
+
+ltcvs_t* ltcvs_create(void)
+{
+  static std::once_flag registered;
+  std::call_once(registered,av_register_all);
+  return new(std::nothrow) ltcvs_t;
+}
+
+int ltcvs_open(ltcvs_t* h, const char* filename, unsigned int channel)
+{
+  if( h->dec )
+    return h->fail("The source is already open.");
+  try{
+    h->dec = new decoder_t(filename,0,std::set<uint32_t>(),channel,1,h->null_out,h->null_out);
+    h->dec->b_list = true;
+    h->dec->events = h;
+    h->b_push = false;
+    return 0;
+  }
+  catch( const std::exception& e ){
+    return h->fail(e.what());
+  }
+}
+
+int ltcvs_open_context(ltcvs_t* h, struct AVFormatContext* ic, unsigned int channel)
+{
+  if( h->dec )
+    return h->fail("The source is already open.");
+  try{
+    h->dec = new decoder_t(ic,0,channel,h->null_out,h->null_out);
+    h->dec->b_list = true;
+    h->dec->events = h;
+    h->b_push = true;
+    return 0;
+  }
+  catch( const std::exception& e ){
+    return h->fail(e.what());
+  }
+}
+
+void ltcvs_set_callbacks(ltcvs_t* h, ltcvs_sync_cb_t sync_cb, ltcvs_ltc_cb_t ltc_cb, void* userdata)
+{
+  h->sync_cb = sync_cb;
+  h->ltc_cb = ltc_cb;
+  h->userdata = userdata;
+}
+
+int ltcvs_run(ltcvs_t* h)
+{
+  if( !h->dec || h->b_push )
+    return h->fail("No file is open.");
+  try{
+    if( h->dec->is_seekable() ){
+      h->dec->scan_frame_map();
+      h->dec->sort_frames();
+    }else{
+      h->dec->scan_stream();
+    }
+    return 0;
+  }
+  catch( const std::exception& e ){
+    return h->fail(e.what());
+  }
+}
+
+int ltcvs_push_packet(ltcvs_t* h, struct AVPacket* packet)
+{
+  if( !h->dec || !h->b_push )
+    return h->fail("No format context is open.");
+  try{
+    h->dec->push_packet(packet);
+    return 0;
+  }
+  catch( const std::exception& e ){
+    return h->fail(e.what());
+  }
+}
+
+int ltcvs_finish(ltcvs_t* h)
+{
+  if( !h->dec || !h->b_push )
+    return h->fail("No format context is open.");
+  try{
+    h->dec->finish();
+    return 0;
+  }
+  catch( const std::exception& e ){
+    return h->fail(e.what());
+  }
+}
+
+const char* ltcvs_error(const ltcvs_t* h)
+{
+  return h->error.empty() ? NULL : h->error.c_str();
+}
+
+void ltcvs_close(ltcvs_t* h)
+{
+  delete h;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
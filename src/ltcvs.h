@@ -0,0 +1,137 @@
+/*
+  ltcvs - C interface of the ltcvideosplit library
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LTCVS_H
+#define LTCVS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AVFormatContext;
+struct AVPacket;
+
+/**
+   Handle of one source (file or caller-demuxed streams).
+ */
+typedef struct ltcvs_t ltcvs_t;
+
+/**
+   Change of the offset between input and LTC frame number.
+ */
+typedef struct {
+  uint32_t inframe;
+  uint32_t ltcframe;
+  int32_t delta;
+  /* position of the video frame relative to the end of the LTC
+     frame, in audio samples: */
+  int64_t offset;
+} ltcvs_sync_t;
+
+/**
+   One decoded LTC frame.
+ */
+typedef struct {
+  /* audio sample positions of the frame start and end: */
+  int64_t off_start;
+  int64_t off_end;
+  /* LTC frame number, and time code: */
+  uint32_t frame;
+  int hours;
+  int mins;
+  int secs;
+  int frames;
+} ltcvs_ltc_t;
+
+typedef void (*ltcvs_sync_cb_t)(void* userdata, const ltcvs_sync_t* sync);
+typedef void (*ltcvs_ltc_cb_t)(void* userdata, const ltcvs_ltc_t* ltc);
+
+/**
+   Create a handle. Returns NULL if out of memory.
+
+   Applications which use libavcodec from several threads have to
+   register a lock manager (av_lockmgr_register()).
+ */
+ltcvs_t* ltcvs_create(void);
+
+/**
+   Open a file (or URL) and read the packets from it with ltcvs_run().
+   'channel' is the audio channel with LTC. Returns 0 on success, -1
+   on error, see ltcvs_error().
+ */
+int ltcvs_open(ltcvs_t* h, const char* filename, unsigned int channel);
+
+/**
+   Use a format context opened by the caller (with stream information
+   retrieved), and push the packets demuxed by the caller with
+   ltcvs_push_packet(). The context is not closed by the library.
+   Returns 0 on success, -1 on error.
+ */
+int ltcvs_open_context(ltcvs_t* h, struct AVFormatContext* ic, unsigned int channel);
+
+/**
+   Set the callbacks for sync changes and decoded LTC frames; either
+   can be NULL. 'userdata' is passed to the callbacks.
+ */
+void ltcvs_set_callbacks(ltcvs_t* h, ltcvs_sync_cb_t sync_cb, ltcvs_ltc_cb_t ltc_cb, void* userdata);
+
+/**
+   Decode a file opened with ltcvs_open() completely. Returns 0 on
+   success, -1 on error.
+ */
+int ltcvs_run(ltcvs_t* h);
+
+/**
+   Process one packet (source opened with ltcvs_open_context()); the
+   packet remains owned by the caller. Sync changes are reported as
+   soon as they are known. Returns 0 on success, -1 on error.
+ */
+int ltcvs_push_packet(ltcvs_t* h, struct AVPacket* packet);
+
+/**
+   Report the remaining sync changes after the last packet. Returns 0
+   on success, -1 on error.
+ */
+int ltcvs_finish(ltcvs_t* h);
+
+/**
+   Message of the last error, or NULL.
+ */
+const char* ltcvs_error(const ltcvs_t* h);
+
+/**
+   Close the source and free the handle.
+ */
+void ltcvs_close(ltcvs_t* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*
+ * Local Variables:
+ * compile-command: "make -C .."
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * mode: c++
+ * End:
+ */
@@ -0,0 +1,701 @@
+/*
+  ltcvsd - align new video files in watched directories
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "error.h"
+#include "workerpool.h"
+#include "ltccache.h"
+#include "clipindex.h"
+#include "decoder.h"
+
+// size limit of a pending request line:
+#define MAX_REQUEST 4096
+
+static volatile sig_atomic_t b_quit(0);
+
+static void on_signal(int)
+{
+  b_quit = 1;
+}
+
+class daemon_options_t {
+public:
+  daemon_options_t();
+  double audiofps;
+  uint32_t channel;
+  uint32_t nthreads;
+  std::string cachedir;
+  std::string socketpath;
+  // accepted file name extensions, all if empty:
+  std::set<std::string> extensions;
+};
+
+daemon_options_t::daemon_options_t()
+  : audiofps(0),
+    channel(0),
+    nthreads(1),
+    socketpath("/tmp/ltcvsd.sock")
+{
+}
+
+/**
+   Decode one file, or read its LTC map from the cache.
+ */
+static void analyze(const std::string& path, const daemon_options_t& opts, index_entry_t& entry)
+{
+  std::ostringstream out;
+  std::ostringstream log;
+  std::string cachefile(ltc_cache_t::cachefile(path,opts.cachedir));
+  ltc_cache_t cache;
+  if( cache.load(cachefile,entry.id,opts.channel) ){
+    decoder_t dec(cache,opts.audiofps,std::set<uint32_t>(),1,out,log);
+    dec.b_timeline = true;
+    dec.sort_frames();
+    dec.get_clips(entry.clips);
+    return;
+  }
+  decoder_t dec(path,opts.audiofps,std::set<uint32_t>(),opts.channel,1,out,log);
+  dec.b_timeline = true;
+  dec.b_keep_records = true;
+  dec.scan_frame_map();
+  dec.sort_frames();
+  dec.get_clips(entry.clips);
+  cache.id = entry.id;
+  dec.get_cache(cache);
+  cache.save(cachefile);
+}
+
+/**
+   Result of a job, passed from the worker to the main loop.
+ */
+class job_result_t {
+public:
+  std::string path;
+  index_entry_t entry;
+  // the file did not change since it was indexed:
+  bool b_unchanged;
+};
+
+/**
+   Connection of a client of the query socket.
+ */
+class client_t {
+public:
+  int fd;
+  std::string in;
+  std::string out;
+};
+
+/**
+   Watch directories, decode new and modified files in a worker pool,
+   and answer queries on a Unix domain socket.
+
+   Directory events, results of the workers and the clients are
+   handled in one thread; the index and the job states are thus not
+   shared with the workers. Each file is queued at most once, an event
+   for a file which is being decoded causes a single repetition. At
+   most one job per worker is handed to the pool, the others wait in
+   the queue of the daemon.
+ */
+class watch_daemon_t {
+public:
+  watch_daemon_t(const daemon_options_t& opts_);
+  ~watch_daemon_t();
+  /**
+     Watch a directory and its subdirectories, and queue the files
+     found in them.
+   */
+  void watch(const std::string& dir);
+  void run();
+private:
+  enum job_state_t {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    // an event arrived while decoding, decode again:
+    JOB_REPEAT
+  };
+  bool is_media(const std::string& name) const;
+  void enqueue(const std::string& path);
+  void dispatch();
+  void collect();
+  void read_events();
+  void unwatch(const std::string& dir);
+  void rescan();
+  void accept_client();
+  bool read_client(client_t& client);
+  void answer(const std::string& request, std::ostream& reply);
+  daemon_options_t opts;
+  int fd_inotify;
+  int fd_listen;
+  int fd_done[2];
+  std::map<int,std::string> dirs;
+  std::map<std::string,job_state_t> states;
+  std::deque<std::string> queue;
+  uint32_t running;
+  clip_index_t index;
+  std::vector<client_t> clients;
+  std::mutex mtx;
+  std::vector<job_result_t> done;
+  worker_pool_t pool;
+};
+
+watch_daemon_t::watch_daemon_t(const daemon_options_t& opts_)
+  : opts(opts_),
+    fd_inotify(inotify_init1(IN_NONBLOCK|IN_CLOEXEC)),
+    fd_listen(socket(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0)),
+    running(0),
+    pool(opts.nthreads)
+{
+  fd_done[0] = fd_done[1] = -1;
+  if( fd_inotify < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to initialize inotify: %s",strerror(errno));
+  if( fd_listen < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to create socket: %s",strerror(errno));
+  if( pipe2(fd_done,O_NONBLOCK|O_CLOEXEC) != 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to create pipe: %s",strerror(errno));
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if( opts.socketpath.size() >= sizeof(addr.sun_path) )
+    throw error_msg_t(__FILE__,__LINE__,"Socket path \"%s\" is too long.",opts.socketpath.c_str());
+  strcpy(addr.sun_path,opts.socketpath.c_str());
+  // socket of a previous instance:
+  unlink(opts.socketpath.c_str());
+  if( (bind(fd_listen,(struct sockaddr*)&addr,sizeof(addr)) != 0) || (listen(fd_listen,16) != 0) )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to listen on \"%s\": %s",opts.socketpath.c_str(),strerror(errno));
+}
+
+watch_daemon_t::~watch_daemon_t()
+{
+  // the workers report to the pipe:
+  pool.wait();
+  for(std::vector<client_t>::iterator it=clients.begin();it!=clients.end();++it)
+    close(it->fd);
+  if( fd_listen >= 0 ){
+    close(fd_listen);
+    unlink(opts.socketpath.c_str());
+  }
+  if( fd_inotify >= 0 )
+    close(fd_inotify);
+  for(uint32_t k=0;k<2;++k)
+    if( fd_done[k] >= 0 )
+      close(fd_done[k]);
+}
+
+bool watch_daemon_t::is_media(const std::string& name) const
+{
+  // hidden and temporary files, and the sidecar LTC maps:
+  if( name.empty() || (name[0] == '.') )
+    return false;
+  if( (name.find(".ltcmap") != std::string::npos) || (name.find(".part") != std::string::npos) )
+    return false;
+  if( opts.extensions.empty() )
+    return true;
+  size_t dot(name.rfind('.'));
+  if( dot == std::string::npos )
+    return false;
+  std::string ext(name.substr(dot+1));
+  std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
+  return opts.extensions.find(ext) != opts.extensions.end();
+}
+
+void watch_daemon_t::watch(const std::string& dir)
+{
+  int wd(inotify_add_watch(fd_inotify,dir.c_str(),
+                           IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_CREATE|IN_ONLYDIR));
+  if( wd < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to watch \"%s\": %s",dir.c_str(),strerror(errno));
+  dirs[wd] = dir;
+  // files created before the watch was added:
+  DIR* dh(opendir(dir.c_str()));
+  if( !dh )
+    return;
+  std::vector<std::string> subdirs;
+  while( struct dirent* de = readdir(dh) ){
+    std::string name(de->d_name);
+    if( (name == ".") || (name == "..") )
+      continue;
+    std::string path(dir+"/"+name);
+    struct stat st;
+    // symbolic links to directories are not followed:
+    if( lstat(path.c_str(),&st) != 0 )
+      continue;
+    if( S_ISDIR(st.st_mode) )
+      subdirs.push_back(path);
+    else if( is_media(name) && (stat(path.c_str(),&st) == 0) && S_ISREG(st.st_mode) )
+      enqueue(path);
+  }
+  closedir(dh);
+  for(std::vector<std::string>::const_iterator it=subdirs.begin();it!=subdirs.end();++it){
+    try{
+      watch(*it);
+    }
+    catch( const std::exception& e ){
+      std::cerr << "Warning: " << e.what() << "\n";
+    }
+  }
+}
+
+void watch_daemon_t::enqueue(const std::string& path)
+{
+  std::map<std::string,job_state_t>::iterator it(states.find(path));
+  if( it == states.end() ){
+    states[path] = JOB_QUEUED;
+    queue.push_back(path);
+  }else if( it->second == JOB_RUNNING ){
+    it->second = JOB_REPEAT;
+  }
+}
+
+/**
+   Hand queued files to idle workers.
+ */
+void watch_daemon_t::dispatch()
+{
+  while( !queue.empty() && (running < pool.size()) ){
+    std::string path(queue.front());
+    queue.pop_front();
+    states[path] = JOB_RUNNING;
+    ++running;
+    const index_entry_t* previous(index.find(path));
+    file_id_t previous_id(previous ? previous->id : file_id_t());
+    pool.add([this,path,previous_id](){
+        job_result_t result;
+        result.path = path;
+        result.b_unchanged = false;
+        try{
+          result.entry.id = file_id_t(path);
+          if( result.entry.id == previous_id )
+            result.b_unchanged = true;
+          else
+            analyze(path,opts,result.entry);
+        }
+        catch( const std::exception& e ){
+          result.entry.clips.clear();
+          result.entry.error = e.what();
+        }
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          done.push_back(result);
+        }
+        char c(0);
+        if( write(fd_done[1],&c,1) < 0 ){
+          // the pipe is full, the main loop is woken up anyway
+        }
+      });
+  }
+}
+
+/**
+   Store the results of finished jobs in the index.
+ */
+void watch_daemon_t::collect()
+{
+  char buf[256];
+  while( read(fd_done[0],buf,sizeof(buf)) > 0 );
+  std::vector<job_result_t> results;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    results.swap(done);
+  }
+  for(std::vector<job_result_t>::iterator it=results.begin();it!=results.end();++it){
+    --running;
+    job_state_t state(states[it->path]);
+    states.erase(it->path);
+    struct stat st;
+    if( stat(it->path.c_str(),&st) != 0 ){
+      // deleted while decoding:
+      index.remove(it->path);
+    }else if( !it->b_unchanged ){
+      if( it->entry.error.empty() )
+        std::cerr << it->path << ": " << it->entry.clips.size() << " clips\n";
+      else
+        std::cerr << it->path << ": Error: " << it->entry.error << "\n";
+      index.set(it->path,it->entry);
+    }
+    if( state == JOB_REPEAT )
+      enqueue(it->path);
+  }
+  std::cerr.flush();
+}
+
+void watch_daemon_t::read_events()
+{
+  char buf[16384] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while( (len = read(fd_inotify,buf,sizeof(buf))) > 0 ){
+    for(char* p=buf;p<buf+len;){
+      const struct inotify_event* ev((const struct inotify_event*)p);
+      p += sizeof(struct inotify_event) + ev->len;
+      if( ev->mask & IN_Q_OVERFLOW ){
+        rescan();
+        continue;
+      }
+      if( ev->mask & IN_IGNORED ){
+        dirs.erase(ev->wd);
+        continue;
+      }
+      std::map<int,std::string>::const_iterator dir(dirs.find(ev->wd));
+      if( (dir == dirs.end()) || !ev->len )
+        continue;
+      std::string name(ev->name);
+      std::string path(dir->second+"/"+name);
+      if( ev->mask & IN_ISDIR ){
+        if( ev->mask & (IN_CREATE|IN_MOVED_TO) ){
+          try{
+            watch(path);
+          }
+          catch( const std::exception& e ){
+            std::cerr << "Warning: " << e.what() << "\n";
+          }
+        }else if( ev->mask & (IN_DELETE|IN_MOVED_FROM) ){
+          unwatch(path);
+        }
+        continue;
+      }
+      if( !is_media(name) )
+        continue;
+      if( ev->mask & (IN_CLOSE_WRITE|IN_MOVED_TO) )
+        enqueue(path);
+      else if( ev->mask & (IN_DELETE|IN_MOVED_FROM) )
+        index.remove(path);
+    }
+  }
+}
+
+/**
+   Stop watching a removed or renamed directory and its
+   subdirectories, and remove their files from the index.
+ */
+void watch_daemon_t::unwatch(const std::string& dir)
+{
+  std::string prefix(dir+"/");
+  for(std::map<int,std::string>::iterator it=dirs.begin();it!=dirs.end();){
+    if( (it->second == dir) || (it->second.compare(0,prefix.size(),prefix) == 0) ){
+      inotify_rm_watch(fd_inotify,it->first);
+      dirs.erase(it++);
+    }else{
+      ++it;
+    }
+  }
+  index.remove_dir(dir);
+}
+
+/**
+   Events were lost: queue all files again; unchanged files are only
+   identified, not decoded.
+ */
+void watch_daemon_t::rescan()
+{
+  std::vector<std::string> watched;
+  for(std::map<int,std::string>::const_iterator it=dirs.begin();it!=dirs.end();++it){
+    inotify_rm_watch(fd_inotify,it->first);
+    watched.push_back(it->second);
+  }
+  dirs.clear();
+  for(std::vector<std::string>::const_iterator it=watched.begin();it!=watched.end();++it){
+    try{
+      watch(*it);
+    }
+    catch( const std::exception& e ){
+      std::cerr << "Warning: " << e.what() << "\n";
+    }
+  }
+}
+
+void watch_daemon_t::accept_client()
+{
+  int fd;
+  while( (fd = accept4(fd_listen,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0 ){
+    client_t client;
+    client.fd = fd;
+    clients.push_back(client);
+  }
+}
+
+/**
+   Read requests of a client and queue the replies. Returns false if
+   the connection is closed.
+ */
+bool watch_daemon_t::read_client(client_t& client)
+{
+  char buf[4096];
+  ssize_t len;
+  while( (len = read(client.fd,buf,sizeof(buf))) > 0 )
+    client.in.append(buf,len);
+  if( (len == 0) || ((len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) )
+    return false;
+  size_t eol;
+  std::ostringstream reply;
+  while( (eol = client.in.find('\n')) != std::string::npos ){
+    std::string request(client.in.substr(0,eol));
+    client.in.erase(0,eol+1);
+    if( !request.empty() && (request[request.size()-1] == '\r') )
+      request.erase(request.size()-1);
+    answer(request,reply);
+  }
+  client.out += reply.str();
+  return client.in.size() <= MAX_REQUEST;
+}
+
+/**
+   Requests:
+
+   file PATH: sync segments of a file, "inframe ltcframe nframes"
+
+   covering FRAME: clips covering LTC frame FRAME, "frame inframe
+   ltcframe nframes path", where 'frame' is the input frame with this
+   LTC frame
+
+   status: number of files, errors, queued and running jobs
+ */
+void watch_daemon_t::answer(const std::string& request, std::ostream& reply)
+{
+  std::string cmd(request.substr(0,request.find(' ')));
+  std::string arg((cmd.size() < request.size()) ? request.substr(cmd.size()+1) : "");
+  if( cmd == "file" ){
+    std::string path(arg);
+    char rpath[PATH_MAX];
+    if( realpath(arg.c_str(),rpath) )
+      path = rpath;
+    if( states.find(path) != states.end() ){
+      reply << "pending\n";
+      return;
+    }
+    const index_entry_t* e(index.find(path));
+    if( !e ){
+      reply << "unknown\n";
+    }else if( !e->error.empty() ){
+      reply << "error " << e->error << "\n";
+    }else{
+      reply << "ok " << e->clips.size() << "\n";
+      for(std::vector<clip_t>::const_iterator it=e->clips.begin();it!=e->clips.end();++it)
+        reply << it->inframe << " " << it->ltcframe << " " << it->nframes << "\n";
+    }
+  }else if( cmd == "covering" ){
+    char* end(NULL);
+    unsigned long frame(strtoul(arg.c_str(),&end,10));
+    if( arg.empty() || *end ){
+      reply << "error invalid frame\n";
+      return;
+    }
+    std::vector<const clip_t*> clips;
+    index.covering(frame,clips);
+    reply << "ok " << clips.size() << "\n";
+    for(std::vector<const clip_t*>::const_iterator it=clips.begin();it!=clips.end();++it)
+      reply << (*it)->inframe+(frame-(*it)->ltcframe) << " " << (*it)->inframe << " " <<
+        (*it)->ltcframe << " " << (*it)->nframes << " " << (*it)->filename << "\n";
+  }else if( cmd == "status" ){
+    reply << "ok files " << index.size() << " errors " << index.errors() <<
+      " queued " << queue.size() << " running " << running << "\n";
+  }else{
+    reply << "error invalid request\n";
+  }
+}
+
+void watch_daemon_t::run()
+{
+  std::vector<struct pollfd> fds;
+  while( !b_quit ){
+    dispatch();
+    fds.clear();
+    struct pollfd pfd;
+    pfd.revents = 0;
+    pfd.events = POLLIN;
+    pfd.fd = fd_inotify;
+    fds.push_back(pfd);
+    pfd.fd = fd_listen;
+    fds.push_back(pfd);
+    pfd.fd = fd_done[0];
+    fds.push_back(pfd);
+    for(std::vector<client_t>::const_iterator it=clients.begin();it!=clients.end();++it){
+      pfd.fd = it->fd;
+      pfd.events = it->out.empty() ? POLLIN : (POLLIN|POLLOUT);
+      fds.push_back(pfd);
+    }
+    if( poll(&(fds[0]),fds.size(),-1) < 0 ){
+      if( errno == EINTR )
+        continue;
+      throw error_msg_t(__FILE__,__LINE__,"poll failed: %s",strerror(errno));
+    }
+    if( fds[0].revents )
+      read_events();
+    if( fds[2].revents )
+      collect();
+    // clients, before new ones are added:
+    std::vector<client_t> open;
+    for(size_t k=0;k<clients.size();++k){
+      client_t& client(clients[k]);
+      short ev(fds[k+3].revents);
+      bool b_open(!(ev & (POLLERR|POLLNVAL)));
+      if( b_open && (ev & (POLLIN|POLLHUP)) )
+        b_open = read_client(client);
+      if( b_open && !client.out.empty() ){
+        ssize_t len(send(client.fd,client.out.c_str(),client.out.size(),MSG_NOSIGNAL));
+        if( len > 0 )
+          client.out.erase(0,len);
+        else if( (len < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) )
+          b_open = false;
+      }
+      if( b_open )
+        open.push_back(client);
+      else
+        close(client.fd);
+    }
+    clients.swap(open);
+    if( fds[1].revents )
+      accept_client();
+  }
+  std::cerr << "Waiting for " << running << " running jobs.\n";
+}
+
+/**
+   Lock manager for libavcodec, required when codecs are opened in
+   several threads.
+ */
+static int av_lockmgr(void** mutex, enum AVLockOp op)
+{
+  switch( op ){
+  case AV_LOCK_CREATE:
+    *mutex = new std::mutex;
+    break;
+  case AV_LOCK_OBTAIN:
+    ((std::mutex*)(*mutex))->lock();
+    break;
+  case AV_LOCK_RELEASE:
+    ((std::mutex*)(*mutex))->unlock();
+    break;
+  case AV_LOCK_DESTROY:
+    delete (std::mutex*)(*mutex);
+    *mutex = NULL;
+    break;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  std::ios_base::sync_with_stdio(false);
+  std::cerr << "ltcvsd version " << VERSION_MAJOR << "." << VERSION_MINOR << std::endl;
+  try{
+    av_register_all();
+    av_lockmgr_register(av_lockmgr);
+    daemon_options_t opts;
+    const char *options = "hf:c:j:C:s:e:";
+    struct option long_options[] = {
+      { "help", 0, 0, 'h' },
+      { "fps",  1, 0, 'f' },
+      { "channel", 1, 0, 'c' },
+      { "jobs", 1, 0, 'j' },
+      { "cachedir", 1, 0, 'C' },
+      { "socket", 1, 0, 's' },
+      { "extension", 1, 0, 'e' },
+      { 0, 0, 0, 0 }
+    };
+    int opt(0);
+    int option_index(0);
+    while( (opt = getopt_long(argc, argv, options,
+                              long_options, &option_index)) != -1){
+      switch(opt){
+      case 'h':
+        std::cout << "Usage:\n\nltcvsd [options] directory [directory ...]\n\n";
+        std::cout << "-f overrides the frame rate embedded in the audio\n";
+        std::cout << "-c selects the audio channel with LTC (default 0)\n";
+        std::cout << "-j sets the number of files decoded in parallel\n";
+        std::cout << "-C stores the LTC maps in a directory instead of sidecar files\n";
+        std::cout << "-s sets the path of the query socket (default /tmp/ltcvsd.sock)\n";
+        std::cout << "-e accepts only files with this extension, can be repeated\n";
+        return 0;
+      case 'f':
+        opts.audiofps = atof(optarg);
+        break;
+      case 'c':
+        opts.channel = atoi(optarg);
+        break;
+      case 'j':
+        opts.nthreads = std::max(1,atoi(optarg));
+        break;
+      case 'C':
+        opts.cachedir = optarg;
+        break;
+      case 's':
+        opts.socketpath = optarg;
+        break;
+      case 'e':
+        {
+          std::string ext(optarg);
+          if( !ext.empty() && (ext[0] == '.') )
+            ext.erase(0,1);
+          std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
+          opts.extensions.insert(ext);
+        }
+        break;
+      }
+    }
+    if( optind >= argc )
+      throw error_msg_t(__FILE__,__LINE__,"No directory to watch.");
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGTERM,&sa,NULL);
+    signal(SIGPIPE,SIG_IGN);
+    watch_daemon_t daemon(opts);
+    for(int k=optind;k<argc;++k){
+      char rpath[PATH_MAX];
+      if( !realpath(argv[k],rpath) )
+        throw error_msg_t(__FILE__,__LINE__,"Invalid directory \"%s\".",argv[k]);
+      daemon.watch(rpath);
+    }
+    daemon.run();
+  }
+  catch( const std::exception& e ){
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
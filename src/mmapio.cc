@@ -0,0 +1,290 @@
+/*
+  mmapio - input layer for large local files
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "mmapio.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// "read" mode: buffer of libavformat, and size of each read:
+#define IO_READ_BUFFER_SIZE (4<<20)
+// "mmap" mode: buffer of libavformat, data is copied from the map:
+#define IO_MMAP_BUFFER_SIZE (256<<10)
+// read ahead window:
+#define IO_READAHEAD (32<<20)
+// pages further behind the read position are dropped from the cache:
+#define IO_DROP_BEHIND (64<<20)
+
+enum io_mode_t {
+  IO_DEFAULT,
+  IO_MMAP,
+  IO_READ
+};
+
+static io_mode_t io_mode(IO_DEFAULT);
+
+/**
+   One open input file, the opaque pointer of the AVIOContext.
+ */
+class input_file_t {
+public:
+  input_file_t(io_mode_t mode_);
+  ~input_file_t();
+  bool open(const std::string& filename);
+  int buffer_size() const;
+  static int read(void* opaque, uint8_t* buf, int buf_size);
+  static int64_t seek(void* opaque, int64_t offset, int whence);
+private:
+  void advise();
+  void refresh();
+  io_mode_t mode;
+  int fd;
+  uint8_t* map;
+  // size of the map, the file may have grown since:
+  int64_t mapsize;
+  int64_t size;
+  int64_t pos;
+  // end of the range announced for read ahead:
+  int64_t ahead;
+  // start of the range still in the page cache, page aligned:
+  int64_t dropped;
+  int64_t pagesize;
+};
+
+input_file_t::input_file_t(io_mode_t mode_)
+  : mode(mode_),
+    fd(-1),
+    map(NULL),
+    mapsize(0),
+    size(0),
+    pos(0),
+    ahead(0),
+    dropped(0),
+    pagesize(sysconf(_SC_PAGESIZE))
+{
+}
+
+input_file_t::~input_file_t()
+{
+  if( map )
+    munmap(map,mapsize);
+  if( fd >= 0 )
+    close(fd);
+}
+
+bool input_file_t::open(const std::string& filename)
+{
+  fd = ::open(filename.c_str(),O_RDONLY);
+  if( fd < 0 )
+    return false;
+  struct stat st;
+  if( fstat(fd,&st) != 0 )
+    return false;
+  size = st.st_size;
+  posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+  if( (mode == IO_MMAP) && (size > 0) ){
+    void* p(mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0));
+    if( p == MAP_FAILED ){
+      // e.g. address space exhausted, read instead:
+      mode = IO_READ;
+    }else{
+      map = (uint8_t*)p;
+      mapsize = size;
+      madvise(map,size,MADV_SEQUENTIAL);
+    }
+  }
+  advise();
+  return true;
+}
+
+int input_file_t::buffer_size() const
+{
+  return (mode == IO_MMAP) ? IO_MMAP_BUFFER_SIZE : IO_READ_BUFFER_SIZE;
+}
+
+/**
+   Announce the range after the read position, and drop the range
+   far behind it.
+ */
+void input_file_t::advise()
+{
+  if( pos + IO_READAHEAD/2 > ahead ){
+    int64_t from(std::max(ahead,pos) & ~(pagesize-1));
+    ahead = std::min(pos+IO_READAHEAD,size);
+    if( ahead > from ){
+      if( map && (ahead <= mapsize) )
+        madvise(map+from,ahead-from,MADV_WILLNEED);
+      else
+        posix_fadvise(fd,from,ahead-from,POSIX_FADV_WILLNEED);
+    }
+  }
+  if( pos - dropped > 2*IO_DROP_BEHIND ){
+    int64_t to((pos-IO_DROP_BEHIND) & ~(pagesize-1));
+    if( map && (to <= mapsize) )
+      madvise(map+dropped,to-dropped,MADV_DONTNEED);
+    posix_fadvise(fd,dropped,to-dropped,POSIX_FADV_DONTNEED);
+    dropped = to;
+  }
+}
+
+/**
+   Update the size of a growing file.
+ */
+void input_file_t::refresh()
+{
+  struct stat st;
+  if( (fstat(fd,&st) == 0) && (st.st_size > size) )
+    size = st.st_size;
+}
+
+int input_file_t::read(void* opaque, uint8_t* buf, int buf_size)
+{
+  input_file_t* f((input_file_t*)opaque);
+  if( f->pos >= f->size )
+    f->refresh();
+  int64_t n(std::min((int64_t)buf_size,f->size-f->pos));
+  if( n <= 0 )
+    return AVERROR_EOF;
+  if( f->map && (f->pos+n <= f->mapsize) ){
+    memcpy(buf,f->map+f->pos,n);
+  }else{
+    n = pread(f->fd,buf,n,f->pos);
+    if( n < 0 )
+      return AVERROR(errno);
+    if( n == 0 )
+      return AVERROR_EOF;
+  }
+  f->pos += n;
+  f->advise();
+  return n;
+}
+
+int64_t input_file_t::seek(void* opaque, int64_t offset, int whence)
+{
+  input_file_t* f((input_file_t*)opaque);
+  switch( whence & ~AVSEEK_FORCE ){
+  case AVSEEK_SIZE:
+    f->refresh();
+    return f->size;
+  case SEEK_SET:
+    break;
+  case SEEK_CUR:
+    offset += f->pos;
+    break;
+  case SEEK_END:
+    offset += f->size;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+  if( offset < 0 )
+    return AVERROR(EINVAL);
+  f->pos = offset;
+  // a backward seek re-reads dropped pages, which are dropped again
+  // later; the read ahead starts at the new position:
+  f->dropped = std::min(f->dropped,offset & ~(f->pagesize-1));
+  f->ahead = std::min(f->ahead,offset);
+  f->advise();
+  return offset;
+}
+
+static void free_io(AVIOContext* pb)
+{
+  delete (input_file_t*)(pb->opaque);
+  av_free(pb->buffer);
+  av_free(pb);
+}
+
+int open_input(AVFormatContext** ctx, const std::string& filename)
+{
+  struct stat st;
+  if( (io_mode == IO_DEFAULT) || (stat(filename.c_str(),&st) != 0) || !S_ISREG(st.st_mode) )
+    return avformat_open_input(ctx, filename.c_str(), NULL, NULL);
+  input_file_t* file(new input_file_t(io_mode));
+  if( !file->open(filename) ){
+    int err(errno ? errno : EIO);
+    delete file;
+    return AVERROR(err);
+  }
+  uint8_t* buffer((uint8_t*)av_malloc(file->buffer_size()));
+  AVIOContext* pb(buffer ? avio_alloc_context(buffer,file->buffer_size(),0,file,input_file_t::read,NULL,input_file_t::seek) : NULL);
+  if( !pb ){
+    av_free(buffer);
+    delete file;
+    return AVERROR(ENOMEM);
+  }
+  pb->seekable = AVIO_SEEKABLE_NORMAL;
+  *ctx = avformat_alloc_context();
+  if( !*ctx ){
+    free_io(pb);
+    return AVERROR(ENOMEM);
+  }
+  (*ctx)->pb = pb;
+  (*ctx)->flags |= AVFMT_FLAG_CUSTOM_IO;
+  // the format context is freed on failure, the I/O context is not:
+  int err(avformat_open_input(ctx, filename.c_str(), NULL, NULL));
+  if( err < 0 )
+    free_io(pb);
+  return err;
+}
+
+void close_input(AVFormatContext** ctx)
+{
+  if( !*ctx )
+    return;
+  AVIOContext* pb(((*ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*ctx)->pb : NULL);
+  avformat_close_input(ctx);
+  if( pb )
+    free_io(pb);
+}
+
+bool input_io_select(const char* mode)
+{
+  if( strcmp(mode,"default") == 0 )
+    io_mode = IO_DEFAULT;
+  else if( strcmp(mode,"mmap") == 0 )
+    io_mode = IO_MMAP;
+  else if( strcmp(mode,"read") == 0 )
+    io_mode = IO_READ;
+  else
+    return false;
+  return true;
+}
+
+const char* input_io_mode()
+{
+  switch( io_mode ){
+  case IO_MMAP:
+    return "mmap";
+  case IO_READ:
+    return "read";
+  default:
+    return "default";
+  }
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
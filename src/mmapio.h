@@ -0,0 +1,76 @@
+/*
+  mmapio - input layer for large local files
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef MMAPIO_H
+#define MMAPIO_H
+
+#include <string>
+
+extern "C" {
+
+#include <libavformat/avformat.h>
+
+}
+
+/**
+   Open an input file with avformat_open_input(), through the
+   selected I/O layer.
+
+   Only regular files use the I/O layer; pipes, devices and URLs are
+   always opened with the I/O of libavformat. Returns the error code
+   of avformat_open_input().
+ */
+int open_input(AVFormatContext** ctx, const std::string& filename);
+
+/**
+   Close an input file opened with open_input().
+ */
+void close_input(AVFormatContext** ctx);
+
+/**
+   Select the I/O layer by name:
+
+   "default": I/O of libavformat.
+
+   "mmap": the file is memory mapped.
+
+   "read": large reads into the buffer of libavformat.
+
+   Both "mmap" and "read" announce sequential access and read ahead to
+   the kernel, and drop the pages behind the read position from the
+   page cache, so that processing large amounts of data does not
+   evict other files from the cache.
+
+   Returns false if the name is unknown; the selection is then
+   unchanged.
+ */
+bool input_io_select(const char* mode);
+
+/**
+   Name of the currently selected I/O layer.
+ */
+const char* input_io_mode();
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,356 @@
+/*
+  splitter - cut a video file into sync segments without re-encoding
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "splitter.h"
+#include "error.h"
+#include "workerpool.h"
+#include "mmapio.h"
+#include <algorithm>
+
+// packets of different streams may be stored this far apart in the
+// file, in seconds:
+#define INTERLEAVE_MARGIN 2.0
+
+splitter_t::state_t::state_t()
+  : wrt(NULL),
+    b_done(false),
+    keypos(0),
+    startpos(0),
+    b_lead(false),
+    dts_delay(0)
+{
+}
+
+splitter_t::splitter_t(AVFormatContext* ic, const std::vector<int>& streams, AVRational tb, const std::vector<segment_t>& segments, bool smartrender, uint32_t first, uint32_t last)
+  : ic_(ic),
+    streams_(streams),
+    tb_(tb),
+    segments_(segments),
+    state(segments.size()),
+    last_(std::min(last,(uint32_t)segments.size())),
+    first_open(std::min(first,last_)),
+    margin(INTERLEAVE_MARGIN/av_q2d(tb)),
+    b_smart(smartrender),
+    dec(NULL),
+    frame(NULL),
+    buffered(0)
+{
+  if( streams_.empty() )
+    throw error_msg_t(__FILE__,__LINE__,"No streams to be split.");
+}
+
+splitter_t::~splitter_t()
+{
+  for(uint32_t k=0;k<state.size();++k){
+    for(uint32_t p=0;p<state[k].pending.size();++p)
+      av_free_packet(&(state[k].pending[p]));
+    for(uint32_t p=0;p<state[k].prevgop.size();++p)
+      av_free_packet(&(state[k].prevgop[p]));
+    for(uint32_t p=0;p<state[k].lead.size();++p)
+      av_free_packet(&(state[k].lead[p]));
+    delete state[k].wrt;
+  }
+  for(uint32_t p=0;p<gop.size();++p)
+    av_free_packet(&(gop[p]));
+  if( dec ){
+    avcodec_close(dec);
+    av_free(dec);
+  }
+  if( frame )
+    avcodec_free_frame(&frame);
+}
+
+/**
+   Presentation time of a packet in units of the segment time base.
+ */
+int64_t splitter_t::position(const AVPacket* pkt) const
+{
+  int64_t ts((pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts);
+  if( ts == AV_NOPTS_VALUE )
+    return AV_NOPTS_VALUE;
+  return av_rescale_q(ts,ic_->streams[pkt->stream_index]->time_base,tb_);
+}
+
+void splitter_t::write(uint32_t seg, const AVPacket* pkt)
+{
+  const segment_t& s(segments_[seg]);
+  if( state[seg].wrt->add_packet(pkt,s.ltctime-s.start*av_q2d(tb_)) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Unable to write to \"%s\".",s.filename.c_str());
+}
+
+void splitter_t::keep(std::vector<AVPacket>& buf, const AVPacket* pkt)
+{
+  AVPacket cp;
+  av_init_packet(&cp);
+  if( av_copy_packet(&cp,pkt) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Could not copy packet.");
+  buf.push_back(cp);
+  buffered += cp.size;
+}
+
+void splitter_t::drop(std::vector<AVPacket>& buf)
+{
+  for(uint32_t p=0;p<buf.size();++p){
+    buffered -= buf[p].size;
+    av_free_packet(&(buf[p]));
+  }
+  buf.clear();
+}
+
+void splitter_t::close(uint32_t seg)
+{
+  state_t& st(state[seg]);
+  if( st.b_lead )
+    end_lead(seg);
+  drop(st.pending);
+  delete st.wrt;
+  st.wrt = NULL;
+  st.b_done = true;
+}
+
+void splitter_t::add_packet(const AVPacket* pkt)
+{
+  if( std::find(streams_.begin(),streams_.end(),pkt->stream_index) == streams_.end() )
+    return;
+  int64_t pos(position(pkt));
+  if( pos == AV_NOPTS_VALUE )
+    return;
+  route(pkt,pos);
+  if( b_smart && (pkt->stream_index == streams_[0]) ){
+    // keep the current GOP, it is decoded if a segment starts in it:
+    if( pkt->flags & AV_PKT_FLAG_KEY )
+      drop(gop);
+    keep(gop,pkt);
+  }
+}
+
+void splitter_t::route(const AVPacket* pkt, int64_t pos)
+{
+  // segments which ended long enough ago will not receive further packets:
+  while( (first_open < last_) && (first_open+1 < segments_.size()) && (segments_[first_open+1].start + margin <= pos) )
+    close(first_open++);
+  if( first_open >= last_ )
+    return;
+  // find the segment of this packet:
+  uint32_t seg(first_open);
+  while( (seg+1 < segments_.size()) && (segments_[seg+1].start <= pos) )
+    ++seg;
+  if( (pos < segments_[seg].start) || (seg >= last_) || state[seg].b_done )
+    return;
+  state_t& st(state[seg]);
+  if( st.b_lead ){
+    if( pkt->stream_index != streams_[0] ){
+      keep(st.pending,pkt);
+      return;
+    }
+    // the leading pictures of an open GOP follow the key frame
+    // directly, and are presented before it:
+    if( pos < st.keypos ){
+      keep(st.lead,pkt);
+      return;
+    }
+    end_lead(seg);
+  }
+  if( !st.wrt ){
+    if( (pkt->stream_index == streams_[0]) && (pkt->flags & AV_PKT_FLAG_KEY) ){
+      st.wrt = new writevideo_t(segments_[seg].filename,ic_,streams_);
+      st.keypos = pos;
+      st.startpos = pos;
+      if( b_smart && (segments_[seg].start < pos) && !gop.empty() ){
+        // the cut is rendered when the leading pictures are known:
+        st.b_lead = true;
+        st.dts_delay = ((pkt->pts != AV_NOPTS_VALUE) && (pkt->dts != AV_NOPTS_VALUE)) ? pkt->pts-pkt->dts : 0;
+        st.prevgop.swap(gop);
+        keep(st.lead,pkt);
+        return;
+      }
+      for(uint32_t p=0;p<st.pending.size();++p)
+        if( position(&(st.pending[p])) >= st.startpos )
+          write(seg,&(st.pending[p]));
+      drop(st.pending);
+    }else if( pkt->stream_index != streams_[0] ){
+      // the key frame may be stored after the audio of the same time:
+      keep(st.pending,pkt);
+      return;
+    }else{
+      return;
+    }
+  }
+  // video frames before the key frame (leading B-frames) can not be
+  // decoded without the previous segment (in smart render mode, they
+  // are encoded again by end_lead()):
+  if( pos >= ((pkt->stream_index == streams_[0]) ? st.keypos : st.startpos) )
+    write(seg,pkt);
+}
+
+/**
+   Smart render: the first video packet after the leading pictures of
+   the key frame of a segment was received (or the input ended).
+   Encode the frames before the key frame, then write the key frame
+   and the packets of the other streams held back so far.
+ */
+void splitter_t::end_lead(uint32_t seg)
+{
+  state_t& st(state[seg]);
+  st.b_lead = false;
+  if( render(seg) )
+    st.startpos = segments_[seg].start;
+  for(uint32_t p=0;p<st.pending.size();++p)
+    if( position(&(st.pending[p])) >= st.startpos )
+      write(seg,&(st.pending[p]));
+  drop(st.pending);
+  write(seg,&(st.lead[0]));
+  drop(st.lead);
+  drop(st.prevgop);
+}
+
+/**
+   Encode the frames from the cut position of a segment up to its
+   first key frame, decoded from the previous GOP, the key frame and
+   its leading pictures. Returns false if the previous GOP is not
+   available.
+ */
+bool splitter_t::render(uint32_t seg)
+{
+  state_t& st(state[seg]);
+  if( st.prevgop.empty() )
+    return false;
+  int64_t dts_delay(st.dts_delay);
+  if( !dec ){
+    AVCodecContext* orig(ic_->streams[streams_[0]]->codec);
+    AVCodec* codec(avcodec_find_decoder( orig->codec_id ));
+    if( !codec )
+      throw error_msg_t(__FILE__,__LINE__,"Unsupported codec %d.", orig->codec_id);
+    dec = avcodec_alloc_context3( codec );
+    if( avcodec_copy_context( dec, orig ) != 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Couldn't copy codec context.");
+    if( avcodec_open2( dec, codec, NULL ) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Couldn't open codec for %s.",codec->long_name);
+    frame = avcodec_alloc_frame();
+  }
+  for(uint32_t p=0;p<st.prevgop.size();++p)
+    render_packet(seg,&(st.prevgop[p]),dts_delay);
+  for(uint32_t p=0;p<st.lead.size();++p)
+    render_packet(seg,&(st.lead[p]),dts_delay);
+  // frames delayed by the decoder:
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  pkt.stream_index = streams_[0];
+  while( render_packet(seg,&pkt,dts_delay) );
+  avcodec_flush_buffers(dec);
+  const segment_t& s(segments_[seg]);
+  state[seg].wrt->flush_frames(s.ltctime-s.start*av_q2d(tb_),dts_delay);
+  return true;
+}
+
+/**
+   Decode a video packet and encode the frame if it is part of the
+   segment but before its key frame. Returns true if a frame was
+   decoded.
+ */
+bool splitter_t::render_packet(uint32_t seg, const AVPacket* pkt, int64_t dts_delay)
+{
+  int got_frame(0);
+  avcodec_get_frame_defaults( frame );
+  if( avcodec_decode_video2( dec, frame, &got_frame, pkt ) < 0 )
+    // frames referring to an earlier GOP are not needed
+    return pkt->data != NULL;
+  if( !got_frame )
+    return false;
+  int64_t ts(av_frame_get_best_effort_timestamp( frame ));
+  if( ts == AV_NOPTS_VALUE )
+    return true;
+  int64_t pos(av_rescale_q(ts,ic_->streams[streams_[0]]->time_base,tb_));
+  const segment_t& s(segments_[seg]);
+  if( (pos >= s.start) && (pos < state[seg].keypos) ){
+    frame->pts = ts;
+    if( state[seg].wrt->add_frame(frame,s.ltctime-s.start*av_q2d(tb_),dts_delay) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Unable to write to \"%s\".",s.filename.c_str());
+  }
+  return true;
+}
+
+void splitter_t::flush()
+{
+  for(uint32_t k=first_open;k<last_;++k)
+    if( !state[k].b_done )
+      close(k);
+  first_open = last_;
+}
+
+void export_segments(const std::string& filename, const std::vector<int>& streams, AVRational tb, const std::vector<segment_t>& segments, bool smartrender, uint32_t nthreads, size_t maxbytes)
+{
+  std::vector<std::string> errors(segments.size());
+  byte_budget_t budget(maxbytes);
+  {
+    worker_pool_t pool(std::min(nthreads,(uint32_t)segments.size()));
+    for(uint32_t k=0;k<segments.size();++k)
+      pool.add([&,k](){
+          AVFormatContext* ic(NULL);
+          size_t held(0);
+          budget.enter();
+          try{
+            if( open_input(&ic, filename) < 0 )
+              throw error_msg_t(__FILE__,__LINE__,"Unable to open video file \"%s\".",filename.c_str());
+            if( avformat_find_stream_info( ic, NULL) < 0 )
+              throw error_msg_t(__FILE__,__LINE__,"Unable to retrieve stream information in video file \"%s\".",filename.c_str());
+            for(uint32_t s=0;s<ic->nb_streams;++s)
+              if( std::find(streams.begin(),streams.end(),(int)s) == streams.end() )
+                ic->streams[s]->discard = AVDISCARD_ALL;
+            // seek to the key frame before the segment, early enough
+            // for interleaved audio:
+            int64_t start(std::max((int64_t)0,segments[k].start-(int64_t)(INTERLEAVE_MARGIN/av_q2d(tb))));
+            av_seek_frame(ic,streams[0],av_rescale_q(start,tb,ic->streams[streams[0]]->time_base),AVSEEK_FLAG_BACKWARD);
+            splitter_t split(ic,streams,tb,segments,smartrender,k,k+1);
+            AVPacket packet;
+            av_init_packet( &packet );
+            while( !split.done() && (av_read_frame( ic, &packet ) >= 0) ){
+              split.add_packet( &packet );
+              av_free_packet( &packet );
+              size_t now(split.buffered_bytes());
+              if( now > held )
+                budget.acquire(now-held);
+              else
+                budget.release(held-now);
+              held = now;
+            }
+            split.flush();
+          }
+          catch( const std::exception& e ){
+            errors[k] = e.what();
+          }
+          budget.release(held);
+          budget.leave();
+          if( ic )
+            close_input(&ic);
+        });
+    pool.wait();
+  }
+  for(uint32_t k=0;k<segments.size();++k)
+    if( !errors[k].empty() )
+      throw error_msg_t(__FILE__,__LINE__,"Segment %d: %s",k,errors[k].c_str());
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
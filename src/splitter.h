@@ -0,0 +1,161 @@
+/*
+  splitter - cut a video file into sync segments without re-encoding
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef SPLITTER_H
+#define SPLITTER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "writevideo.h"
+
+/**
+   Part of a video file with constant offset between video frame
+   number and LTC.
+ */
+class segment_t {
+public:
+  // first input video frame:
+  uint32_t inframe;
+  // LTC frame number of the first video frame:
+  uint32_t ltcframe;
+  // position of the first video frame, in audio samples:
+  int64_t start;
+  // LTC time of the first video frame, in seconds:
+  double ltctime;
+  // output file name:
+  std::string filename;
+};
+
+/**
+   Distribute the packets of an input file to one output file per
+   segment.
+
+   Packets are copied. A segment starts with the first video key
+   frame at or after its cut position, earlier packets of that segment
+   are dropped. Time stamps are shifted such that the cut position is
+   at the LTC time of the segment.
+
+   In smart render mode, the video frames between the cut position
+   and the key frame are decoded from the previous GOP and encoded
+   again, which makes the segments frame accurate. In an open GOP,
+   some of these frames (leading pictures) follow the key frame in
+   decoding order; they are decoded as well before the frames are
+   encoded, and their packets are not copied.
+ */
+class splitter_t {
+public:
+  /**
+     @param ic Input format context
+     @param streams Input streams to be copied; the first one is the video stream
+     @param tb Time base of segment_t::start
+     @param segments Segments, sorted by start position
+     @param smartrender Re-encode the frames before the first key frame of each segment
+     @param first First segment to be written
+     @param last End of the range of segments to be written
+   */
+  splitter_t(AVFormatContext* ic, const std::vector<int>& streams, AVRational tb, const std::vector<segment_t>& segments, bool smartrender = false, uint32_t first = 0, uint32_t last = UINT32_MAX);
+  ~splitter_t();
+  /**
+     Pass the next input packet; it remains owned by the caller.
+   */
+  void add_packet(const AVPacket* pkt);
+  /**
+     Close all output files.
+   */
+  void flush();
+  /**
+     True if all segments in the range are complete.
+   */
+  bool done() const { return first_open >= last_; };
+  /**
+     Size of the packets held back by the splitter.
+   */
+  size_t buffered_bytes() const { return buffered; };
+private:
+  class state_t {
+  public:
+    state_t();
+    writevideo_t* wrt;
+    bool b_done;
+    // position of the first key frame:
+    int64_t keypos;
+    // start of the other streams, the key frame or the re-encoded cut:
+    int64_t startpos;
+    // packets of other streams received before the key frame:
+    std::vector<AVPacket> pending;
+    // smart render: waiting for the leading pictures of the key frame:
+    bool b_lead;
+    int64_t dts_delay;
+    // smart render: the GOP before the key frame, and the key frame
+    // followed by its leading pictures:
+    std::vector<AVPacket> prevgop;
+    std::vector<AVPacket> lead;
+  };
+  int64_t position(const AVPacket* pkt) const;
+  void route(const AVPacket* pkt, int64_t pos);
+  void end_lead(uint32_t seg);
+  bool render(uint32_t seg);
+  bool render_packet(uint32_t seg, const AVPacket* pkt, int64_t dts_delay);
+  void write(uint32_t seg, const AVPacket* pkt);
+  void keep(std::vector<AVPacket>& buf, const AVPacket* pkt);
+  void drop(std::vector<AVPacket>& buf);
+  void close(uint32_t seg);
+  AVFormatContext* ic_;
+  std::vector<int> streams_;
+  AVRational tb_;
+  std::vector<segment_t> segments_;
+  std::vector<state_t> state;
+  uint32_t last_;
+  // first segment which is not done:
+  uint32_t first_open;
+  // distance after the end of a segment at which it is closed, in 'tb' units:
+  int64_t margin;
+  bool b_smart;
+  // smart render: video decoder and the packets of the current GOP:
+  AVCodecContext* dec;
+  AVFrame* frame;
+  std::vector<AVPacket> gop;
+  size_t buffered;
+};
+
+/**
+   Write segments in parallel.
+
+   Each job opens the input file, seeks to the start of its segment
+   and writes it with its own splitter_t. The packets held back by
+   all jobs are limited to 'maxbytes'.
+
+   @param filename Input file name
+   @param streams Input streams to be copied; the first one is the video stream
+   @param tb Time base of segment_t::start
+   @param segments Segments, sorted by start position
+   @param smartrender Re-encode the frames before the first key frame of each segment
+   @param nthreads Number of segments written at the same time
+   @param maxbytes Limit of packet memory
+ */
+void export_segments(const std::string& filename, const std::vector<int>& streams, AVRational tb, const std::vector<segment_t>& segments, bool smartrender, uint32_t nthreads, size_t maxbytes);
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,143 @@
+/*
+  spscqueue - bounded single-producer/single-consumer ring
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+/**
+   Bounded lock-free queue between exactly one producer and one
+   consumer thread.
+
+   The slots are allocated once and filled in place: the producer
+   gets the next free slot with write_slot(), fills it and publishes
+   it with push(); the consumer gets the oldest slot with read_slot()
+   and returns it with pop(). Buffers held by a slot (e.g. a
+   std::vector) are thus recycled, and do not need to be reallocated
+   once they have grown to the required size.
+ */
+template<class T> class spsc_queue_t {
+public:
+  spsc_queue_t(uint32_t capacity)
+    : slots(capacity+1),
+      head(0),
+      tail(0),
+      b_closed(false)
+  {
+  }
+  /**
+     Next free slot, or NULL if the queue is full (producer only).
+   */
+  T* write_slot()
+  {
+    size_t t(tail.load(std::memory_order_relaxed));
+    if( next(t) == head.load(std::memory_order_acquire) )
+      return NULL;
+    return &(slots[t]);
+  }
+  /**
+     Publish the slot returned by write_slot() (producer only).
+   */
+  void push()
+  {
+    tail.store(next(tail.load(std::memory_order_relaxed)),std::memory_order_release);
+  }
+  /**
+     Oldest published slot, or NULL if the queue is empty (consumer only).
+   */
+  T* read_slot()
+  {
+    size_t h(head.load(std::memory_order_relaxed));
+    if( h == tail.load(std::memory_order_acquire) )
+      return NULL;
+    return &(slots[h]);
+  }
+  /**
+     Return the slot returned by read_slot() to the producer (consumer only).
+   */
+  void pop()
+  {
+    head.store(next(head.load(std::memory_order_relaxed)),std::memory_order_release);
+  }
+  /**
+     Mark the end of the data; no slot is pushed afterwards (producer only).
+   */
+  void close()
+  {
+    b_closed.store(true,std::memory_order_release);
+  }
+  /**
+     True if the queue is closed and all slots have been consumed
+     (consumer only).
+   */
+  bool finished()
+  {
+    // the closed flag is checked first, a slot pushed before close()
+    // is then visible:
+    return b_closed.load(std::memory_order_acquire) && !read_slot();
+  }
+private:
+  size_t next(size_t i) const
+  {
+    return (i+1 == slots.size()) ? 0 : i+1;
+  }
+  std::vector<T> slots;
+  // consumer and producer position on separate cache lines:
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  std::atomic<bool> b_closed;
+};
+
+/**
+   Wait strategy of a thread polling a spsc_queue_t: spin with yield
+   first, then sleep, so that an idle stage does not take a whole core
+   while waiting for I/O.
+ */
+class spsc_backoff_t {
+public:
+  spsc_backoff_t() : n(0) {}
+  void wait()
+  {
+    if( n < 64 ){
+      ++n;
+      std::this_thread::yield();
+    }else{
+      usleep(100);
+    }
+  }
+  void reset()
+  {
+    n = 0;
+  }
+private:
+  uint32_t n;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,99 @@
+/*
+  stats - counters and timers of the decoding stages
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* stage_names[stats_t::NSTAGES] = {
+  "read", "decode_audio", "convert", "decimate", "ltc_write", "ltc_read", "lookup" };
+
+static const char* stream_names[stats_t::NSTREAMS] = {
+  "video", "audio", "other" };
+
+stats_t::stats_t()
+  : b_enabled(false),
+    samples_converted(0),
+    ltc_frames(0),
+    ltc_dropped(0),
+    video_frames(0)
+{
+  memset(ns,0,sizeof(ns));
+  memset(calls,0,sizeof(calls));
+  memset(packets,0,sizeof(packets));
+  memset(bytes,0,sizeof(bytes));
+}
+
+void stats_t::add(const stats_t& src)
+{
+  for(uint32_t k=0;k<NSTAGES;++k){
+    ns[k] += src.ns[k];
+    calls[k] += src.calls[k];
+  }
+  for(uint32_t k=0;k<NSTREAMS;++k){
+    packets[k] += src.packets[k];
+    bytes[k] += src.bytes[k];
+  }
+  samples_converted += src.samples_converted;
+  ltc_frames += src.ltc_frames;
+  ltc_dropped += src.ltc_dropped;
+  video_frames += src.video_frames;
+}
+
+/**
+   Write a string as JSON string literal.
+ */
+static void json_string(std::ostream& out, const std::string& s)
+{
+  out << '"';
+  for(std::string::const_iterator c=s.begin();c!=s.end();++c){
+    if( (*c == '"') || (*c == '\\') )
+      out << '\\' << *c;
+    else if( (unsigned char)(*c) < 0x20 ){
+      char ctmp[8];
+      sprintf(ctmp,"\\u%04x",*c);
+      out << ctmp;
+    }else
+      out << *c;
+  }
+  out << '"';
+}
+
+void stats_t::write_json(std::ostream& out, const std::string& filename) const
+{
+  out << "{\"file\":";
+  json_string(out,filename);
+  out << ",\"streams\":{";
+  for(uint32_t k=0;k<NSTREAMS;++k)
+    out << (k?",":"") << "\"" << stream_names[k] << "\":{\"packets\":" << packets[k] << ",\"bytes\":" << bytes[k] << "}";
+  out << "},\"samples_converted\":" << samples_converted <<
+    ",\"ltc_frames\":" << ltc_frames <<
+    ",\"ltc_dropped\":" << ltc_dropped <<
+    ",\"video_frames\":" << video_frames <<
+    ",\"stages\":{";
+  for(uint32_t k=0;k<NSTAGES;++k)
+    out << (k?",":"") << "\"" << stage_names[k] << "\":{\"calls\":" << calls[k] << ",\"ns\":" << ns[k] << "}";
+  out << "}}\n";
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
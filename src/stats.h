@@ -0,0 +1,107 @@
+/*
+  stats - counters and timers of the decoding stages
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <string>
+#include <ostream>
+#include <time.h>
+
+/**
+   Counters and cumulative time of the decoding stages.
+
+   Nothing is measured unless 'b_enabled' is set.
+ */
+class stats_t {
+public:
+  enum stage_t {
+    READ,
+    DECODE_AUDIO,
+    CONVERT,
+    DECIMATE,
+    LTC_WRITE,
+    LTC_READ,
+    LOOKUP,
+    NSTAGES
+  };
+  enum stream_t {
+    VIDEO,
+    AUDIO,
+    OTHER,
+    NSTREAMS
+  };
+  stats_t();
+  /**
+     Add the counters of another object, e.g. of a parallel decoder.
+   */
+  void add(const stats_t& src);
+  /**
+     Write all counters as one JSON object.
+   */
+  void write_json(std::ostream& out, const std::string& filename) const;
+  static uint64_t now_ns()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+  };
+  bool b_enabled;
+  uint64_t ns[NSTAGES];
+  uint64_t calls[NSTAGES];
+  uint64_t packets[NSTREAMS];
+  uint64_t bytes[NSTREAMS];
+  uint64_t samples_converted;
+  uint64_t ltc_frames;
+  uint64_t ltc_dropped;
+  uint64_t video_frames;
+};
+
+/**
+   Add the time from construction to destruction to one stage.
+ */
+class stage_timer_t {
+public:
+  stage_timer_t(stats_t& stats, stats_t::stage_t stage)
+    : stats_(stats.b_enabled ? &stats : NULL),
+      stage_(stage),
+      t0(stats_ ? stats_t::now_ns() : 0)
+  {
+  };
+  ~stage_timer_t()
+  {
+    if( stats_ ){
+      stats_->ns[stage_] += stats_t::now_ns()-t0;
+      ++stats_->calls[stage_];
+    }
+  };
+private:
+  stats_t* stats_;
+  stats_t::stage_t stage_;
+  uint64_t t0;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
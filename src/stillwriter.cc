@@ -0,0 +1,158 @@
+/*
+  stillwriter - encode and write still images in parallel
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "stillwriter.h"
+#include "error.h"
+#include <stdio.h>
+
+// converted frames waiting for an encoder, per thread:
+#define STILL_QUEUE_PER_THREAD 2
+
+still_writer_t::still_writer_t(uint32_t nthreads)
+  : sws(NULL),
+    pool(nthreads,STILL_QUEUE_PER_THREAD*nthreads)
+{
+}
+
+still_writer_t::~still_writer_t()
+{
+  pool.wait();
+  for(uint32_t k=0;k<encoders.size();++k){
+    avcodec_close(encoders[k]);
+    av_free(encoders[k]);
+  }
+  if( sws )
+    sws_freeContext(sws);
+}
+
+void still_writer_t::add(const AVFrame* frame, const std::string& filename)
+{
+  AVFrame* img(av_frame_alloc());
+  if( !img )
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  img->format = AV_PIX_FMT_YUVJ420P;
+  img->width = frame->width;
+  img->height = frame->height;
+  if( av_frame_get_buffer(img,32) < 0 ){
+    av_frame_free(&img);
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  }
+  sws = sws_getCachedContext(sws,frame->width,frame->height,(AVPixelFormat)(frame->format),
+                             img->width,img->height,AV_PIX_FMT_YUVJ420P,SWS_BICUBIC,NULL,NULL,NULL);
+  if( !sws ){
+    av_frame_free(&img);
+    throw error_msg_t(__FILE__,__LINE__,"Unsupported pixel format %d.",frame->format);
+  }
+  sws_scale(sws,frame->data,frame->linesize,0,frame->height,img->data,img->linesize);
+  pool.add([this,img,filename](){
+      AVFrame* f(img);
+      try{
+        write(f,filename);
+      }
+      catch( const std::exception& e ){
+        std::unique_lock<std::mutex> lock(mtx);
+        if( error.empty() )
+          error = e.what();
+      }
+      av_frame_free(&f);
+    });
+}
+
+void still_writer_t::wait()
+{
+  pool.wait();
+  std::unique_lock<std::mutex> lock(mtx);
+  if( !error.empty() ){
+    std::string e(error);
+    error.clear();
+    throw error_msg_t(__FILE__,__LINE__,"%s",e.c_str());
+  }
+}
+
+AVCodecContext* still_writer_t::get_encoder(int width, int height)
+{
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    while( !encoders.empty() ){
+      AVCodecContext* enc(encoders.back());
+      encoders.pop_back();
+      if( (enc->width == width) && (enc->height == height) )
+        return enc;
+      avcodec_close(enc);
+      av_free(enc);
+    }
+  }
+  AVCodec* codec(avcodec_find_encoder(AV_CODEC_ID_MJPEG));
+  if( !codec )
+    throw error_msg_t(__FILE__,__LINE__,"MJPEG encoder not found.");
+  AVCodecContext* enc(avcodec_alloc_context3(codec));
+  if( !enc )
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+  enc->width = width;
+  enc->height = height;
+  enc->time_base.num = 1;
+  enc->time_base.den = 25;
+  // constant high quality:
+  enc->qmin = 2;
+  enc->qmax = 2;
+  if( avcodec_open2(enc,codec,NULL) < 0 ){
+    av_free(enc);
+    throw error_msg_t(__FILE__,__LINE__,"Could not open MJPEG encoder.");
+  }
+  return enc;
+}
+
+void still_writer_t::put_encoder(AVCodecContext* enc)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  encoders.push_back(enc);
+}
+
+void still_writer_t::write(AVFrame* frame, const std::string& filename)
+{
+  AVCodecContext* enc(get_encoder(frame->width,frame->height));
+  AVPacket packet;
+  av_init_packet(&packet);
+  packet.data = NULL;
+  packet.size = 0;
+  int got_packet(0);
+  frame->pts = 0;
+  int err(avcodec_encode_video2(enc,&packet,frame,&got_packet));
+  put_encoder(enc);
+  if( (err < 0) || !got_packet )
+    throw error_msg_t(__FILE__,__LINE__,"Could not encode \"%s\".",filename.c_str());
+  FILE* fh(fopen(filename.c_str(),"wb"));
+  if( !fh ){
+    av_free_packet(&packet);
+    throw error_msg_t(__FILE__,__LINE__,"Could not create \"%s\".",filename.c_str());
+  }
+  size_t size(packet.size);
+  size_t written(fwrite(packet.data,1,size,fh));
+  fclose(fh);
+  av_free_packet(&packet);
+  if( written != size )
+    throw error_msg_t(__FILE__,__LINE__,"Could not write \"%s\".",filename.c_str());
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
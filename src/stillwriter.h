@@ -0,0 +1,73 @@
+/*
+  stillwriter - encode and write still images in parallel
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef STILLWRITER_H
+#define STILLWRITER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "workerpool.h"
+
+extern "C" {
+
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+}
+
+/**
+   Write decoded video frames as JPEG files.
+
+   Frames are converted in the calling thread and encoded by a small
+   thread pool. Encoders are kept open and reused for all images of
+   the same size, one per thread.
+ */
+class still_writer_t {
+public:
+  still_writer_t(uint32_t nthreads);
+  ~still_writer_t();
+  /**
+     Queue a frame; the frame can be reused when this function returns.
+   */
+  void add(const AVFrame* frame, const std::string& filename);
+  /**
+     Wait until all queued images are written. Throws an exception if
+     an image could not be written.
+   */
+  void wait();
+private:
+  AVCodecContext* get_encoder(int width, int height);
+  void put_encoder(AVCodecContext* enc);
+  void write(AVFrame* frame, const std::string& filename);
+  struct SwsContext* sws;
+  std::mutex mtx;
+  // idle encoders:
+  std::vector<AVCodecContext*> encoders;
+  std::string error;
+  worker_pool_t pool;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,147 @@
+/*
+  timeline - global LTC timeline of several cameras
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "timeline.h"
+#include <algorithm>
+
+clip_t::clip_t()
+  : camera(0),
+    inframe(0),
+    ltcframe(0),
+    nframes(0)
+{
+}
+
+static bool clip_less(const clip_t& a, const clip_t& b)
+{
+  if( a.ltcframe != b.ltcframe )
+    return a.ltcframe < b.ltcframe;
+  return a.camera < b.camera;
+}
+
+static bool overlap_less(const overlap_t& a, const overlap_t& b)
+{
+  if( a.camera_a != b.camera_a )
+    return a.camera_a < b.camera_a;
+  if( a.camera_b != b.camera_b )
+    return a.camera_b < b.camera_b;
+  return a.from < b.from;
+}
+
+void timeline_t::add(const clip_t& clip)
+{
+  if( clip.nframes )
+    clips_.push_back(clip);
+}
+
+void timeline_t::build()
+{
+  std::sort(clips_.begin(),clips_.end(),clip_less);
+  maxend.resize(clips_.size());
+  build(0,clips_.size());
+}
+
+void timeline_t::build(size_t lo, size_t hi)
+{
+  if( lo >= hi )
+    return;
+  size_t mid((lo+hi)/2);
+  build(lo,mid);
+  build(mid+1,hi);
+  uint32_t m(clips_[mid].end());
+  if( lo < mid )
+    m = std::max(m,maxend[(lo+mid)/2]);
+  if( mid+1 < hi )
+    m = std::max(m,maxend[(mid+1+hi)/2]);
+  maxend[mid] = m;
+}
+
+void timeline_t::query(size_t lo, size_t hi, uint32_t from, uint32_t to, std::vector<const clip_t*>& result) const
+{
+  if( lo >= hi )
+    return;
+  size_t mid((lo+hi)/2);
+  // no clip in this subtree ends after 'from':
+  if( maxend[mid] <= from )
+    return;
+  query(lo,mid,from,to,result);
+  // clips right of 'mid' start at or after this one:
+  if( clips_[mid].ltcframe >= to )
+    return;
+  if( clips_[mid].end() > from )
+    result.push_back(&(clips_[mid]));
+  query(mid+1,hi,from,to,result);
+}
+
+void timeline_t::covering(uint32_t frame, std::vector<const clip_t*>& result) const
+{
+  overlapping(frame,frame+1,result);
+}
+
+void timeline_t::overlapping(uint32_t from, uint32_t to, std::vector<const clip_t*>& result) const
+{
+  result.clear();
+  query(0,clips_.size(),from,to,result);
+}
+
+void timeline_t::overlaps(std::vector<overlap_t>& result) const
+{
+  result.clear();
+  std::vector<const clip_t*> others;
+  for(std::vector<clip_t>::const_iterator it=clips_.begin();it!=clips_.end();++it){
+    overlapping(it->ltcframe,it->end(),others);
+    for(std::vector<const clip_t*>::const_iterator o=others.begin();o!=others.end();++o)
+      // each pair once, from the camera with the lower index:
+      if( (*o)->camera > it->camera ){
+        overlap_t ov;
+        ov.camera_a = it->camera;
+        ov.camera_b = (*o)->camera;
+        ov.from = std::max(it->ltcframe,(*o)->ltcframe);
+        ov.to = std::min(it->end(),(*o)->end());
+        result.push_back(ov);
+      }
+  }
+  std::sort(result.begin(),result.end(),overlap_less);
+}
+
+uint32_t timeline_t::origin() const
+{
+  return clips_.empty() ? 0 : clips_.front().ltcframe;
+}
+
+void timeline_t::write(std::ostream& out) const
+{
+  uint32_t t0(origin());
+  out << "# clips: camera position ltcframe inframe nframes file\n";
+  for(std::vector<clip_t>::const_iterator it=clips_.begin();it!=clips_.end();++it)
+    out << it->camera << " " << it->ltcframe-t0 << " " << it->ltcframe << " " <<
+      it->inframe << " " << it->nframes << " " << it->filename << "\n";
+  std::vector<overlap_t> ov;
+  overlaps(ov);
+  out << "# overlaps: camera camera position ltcframe nframes\n";
+  for(std::vector<overlap_t>::const_iterator it=ov.begin();it!=ov.end();++it)
+    out << it->camera_a << " " << it->camera_b << " " << it->from-t0 << " " <<
+      it->from << " " << it->to-it->from << "\n";
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
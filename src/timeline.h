@@ -0,0 +1,105 @@
+/*
+  timeline - global LTC timeline of several cameras
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+/**
+   A contiguous part of an input file on the LTC timeline, i.e. one
+   sync segment: 'nframes' video frames starting at input frame
+   'inframe' cover the LTC frames 'ltcframe' to 'ltcframe+nframes-1'.
+ */
+class clip_t {
+public:
+  clip_t();
+  uint32_t end() const { return ltcframe+nframes; };
+  std::string filename;
+  // index of the input file:
+  uint32_t camera;
+  uint32_t inframe;
+  uint32_t ltcframe;
+  uint32_t nframes;
+};
+
+/**
+   Common LTC range of two cameras.
+ */
+class overlap_t {
+public:
+  uint32_t camera_a;
+  uint32_t camera_b;
+  uint32_t from;
+  uint32_t to;
+};
+
+/**
+   Clips of several cameras on one LTC timeline.
+
+   After build(), the clips are sorted by LTC start frame and indexed
+   by an interval tree (an implicit balanced tree over the sorted
+   clips, each node holding the maximum end of its subtree), thus the
+   clips covering an LTC frame or range are found in O(log n + k)
+   time.
+ */
+class timeline_t {
+public:
+  void add(const clip_t& clip);
+  void build();
+  /**
+     Clips covering LTC frame 'frame'.
+   */
+  void covering(uint32_t frame, std::vector<const clip_t*>& result) const;
+  /**
+     Clips overlapping the LTC frames 'from' to 'to'-1.
+   */
+  void overlapping(uint32_t from, uint32_t to, std::vector<const clip_t*>& result) const;
+  /**
+     Overlap intervals of every pair of clips of different cameras,
+     sorted by camera pair and start.
+   */
+  void overlaps(std::vector<overlap_t>& result) const;
+  /**
+     First LTC frame of all clips, the origin of the timeline.
+   */
+  uint32_t origin() const;
+  /**
+     Write the placement of each clip and the overlaps as text.
+   */
+  void write(std::ostream& out) const;
+  const std::vector<clip_t>& clips() const { return clips_; };
+private:
+  void build(size_t lo, size_t hi);
+  void query(size_t lo, size_t hi, uint32_t from, uint32_t to, std::vector<const clip_t*>& result) const;
+  std::vector<clip_t> clips_;
+  // maximum end of the subtree rooted at each clip:
+  std::vector<uint32_t> maxend;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -0,0 +1,155 @@
+/*
+  worker pool and ordered output for batch processing
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include "workerpool.h"
+#include <iostream>
+#include <algorithm>
+
+worker_pool_t::worker_pool_t(uint32_t nthreads, uint32_t maxqueue)
+  : busy(0),
+    maxqueue_(maxqueue),
+    b_quit(false)
+{
+  for(uint32_t k=0;k<std::max(nthreads,1u);++k)
+    threads.push_back(std::thread(&worker_pool_t::worker,this));
+}
+
+worker_pool_t::~worker_pool_t()
+{
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    b_quit = true;
+  }
+  cond_job.notify_all();
+  for(uint32_t k=0;k<threads.size();++k)
+    threads[k].join();
+}
+
+void worker_pool_t::add(const std::function<void()>& job)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  while( maxqueue_ && (jobs.size() >= maxqueue_) )
+    cond_space.wait(lock);
+  jobs.push_back(job);
+  cond_job.notify_one();
+}
+
+void worker_pool_t::wait()
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  while( !jobs.empty() || busy )
+    cond_idle.wait(lock);
+}
+
+void worker_pool_t::worker()
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  while( true ){
+    while( jobs.empty() && !b_quit )
+      cond_job.wait(lock);
+    if( jobs.empty() )
+      return;
+    std::function<void()> job(jobs.front());
+    jobs.pop_front();
+    ++busy;
+    cond_space.notify_one();
+    lock.unlock();
+    try{
+      job();
+    }
+    catch( const std::exception& e ){
+      std::cerr << "Error: " << e.what() << std::endl;
+    }
+    lock.lock();
+    --busy;
+    if( jobs.empty() && !busy )
+      cond_idle.notify_all();
+  }
+}
+
+ordered_writer_t::ordered_writer_t(uint32_t njobs, std::ostream& out, std::ostream& log)
+  : outs(njobs),
+    logs(njobs),
+    done(njobs,false),
+    next(0),
+    out_(out),
+    log_(log)
+{
+}
+
+void ordered_writer_t::set(uint32_t job, const std::string& out, const std::string& log)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  outs[job] = out;
+  logs[job] = log;
+  done[job] = true;
+  while( (next < done.size()) && done[next] ){
+    log_ << logs[next];
+    out_ << outs[next];
+    outs[next].clear();
+    logs[next].clear();
+    ++next;
+  }
+  log_.flush();
+  out_.flush();
+}
+
+byte_budget_t::byte_budget_t(size_t maxbytes)
+  : maxbytes_(maxbytes),
+    used(0),
+    active(0),
+    waiting(0)
+{
+}
+
+void byte_budget_t::enter()
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  ++active;
+}
+
+void byte_budget_t::leave()
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  --active;
+  cond.notify_all();
+}
+
+void byte_budget_t::acquire(size_t bytes)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  ++waiting;
+  while( (used + bytes > maxbytes_) && (used > 0) && (waiting < active) )
+    cond.wait(lock);
+  --waiting;
+  used += bytes;
+}
+
+void byte_budget_t::release(size_t bytes)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  used -= std::min(bytes,used);
+  cond.notify_all();
+}
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
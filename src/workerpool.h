@@ -0,0 +1,122 @@
+/*
+  worker pool and ordered output for batch processing
+  Copyright (C) 2016 Giso Grimm
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+
+/**
+   Fixed number of threads processing a job queue.
+
+   Jobs are expected to handle their own errors; exceptions escaping
+   a job are reported on stderr.
+ */
+class worker_pool_t {
+public:
+  /**
+     @param nthreads Number of worker threads
+     @param maxqueue Maximum number of queued jobs, add() blocks if
+     the queue is full (0 = unlimited)
+   */
+  worker_pool_t(uint32_t nthreads, uint32_t maxqueue = 0);
+  ~worker_pool_t();
+  void add(const std::function<void()>& job);
+  /**
+     Wait until the queue is empty and all workers are idle.
+   */
+  void wait();
+  uint32_t size() const { return threads.size(); };
+private:
+  void worker();
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()> > jobs;
+  std::mutex mtx;
+  std::condition_variable cond_job;
+  std::condition_variable cond_space;
+  std::condition_variable cond_idle;
+  uint32_t busy;
+  uint32_t maxqueue_;
+  bool b_quit;
+};
+
+/**
+   Collect text output of numbered jobs and write it in job order.
+
+   The output of job k is written as soon as jobs 0..k are complete.
+ */
+class ordered_writer_t {
+public:
+  ordered_writer_t(uint32_t njobs, std::ostream& out, std::ostream& log);
+  void set(uint32_t job, const std::string& out, const std::string& log);
+private:
+  std::vector<std::string> outs;
+  std::vector<std::string> logs;
+  std::vector<bool> done;
+  uint32_t next;
+  std::ostream& out_;
+  std::ostream& log_;
+  std::mutex mtx;
+};
+
+/**
+   Memory limit shared by several threads.
+
+   acquire() blocks while the limit would be exceeded, unless all
+   other registered threads are blocked as well; a thread which holds
+   memory can thus not wait for itself, and at least one thread always
+   makes progress.
+ */
+class byte_budget_t {
+public:
+  byte_budget_t(size_t maxbytes);
+  /**
+     Register a thread which uses the budget.
+   */
+  void enter();
+  /**
+     Unregister a thread; it has to release all memory before.
+   */
+  void leave();
+  void acquire(size_t bytes);
+  void release(size_t bytes);
+private:
+  size_t maxbytes_;
+  size_t used;
+  uint32_t active;
+  uint32_t waiting;
+  std::mutex mtx;
+  std::condition_variable cond;
+};
+
+#endif
+
+// Local Variables:
+// compile-command: "make -C .."
+// c-basic-offset: 2
+// indent-tabs-mode: nil
+// mode: c++
+// End:
@@ -1,126 +1,281 @@
 #include <iostream>
+#include <math.h>
+#include <string.h>
 
 #include "writevideo.h"
 #include "error.h"
 
-writevideo_t::writevideo_t(const std::string& filename, const AVCodecContext* srcCodec, uint64_t fps_den, uint64_t fps_num )
-  : oc(avformat_alloc_context()),
-    frameno(0)
+/**
+   Extract SPS and PPS from an H.264 decoder configuration record
+   (avcC), as length prefixed NAL units.
+
+   Returns the NAL length size, or 0 if the record is invalid.
+ */
+static uint32_t avcc_param_sets(const uint8_t* p, int size, std::vector<uint8_t>& out)
+{
+  if( (size < 7) || (p[0] != 1) )
+    return 0;
+  uint32_t nal_length_size((p[4] & 3)+1);
+  const uint8_t* end(p+size);
+  p += 5;
+  // SPS count in lower 5 bits, then PPS count in a separate byte:
+  for(uint32_t type=0;type<2;++type){
+    if( p >= end )
+      return 0;
+    uint32_t cnt(type ? *p : (*p & 0x1f));
+    ++p;
+    for(uint32_t k=0;k<cnt;++k){
+      if( p+2 > end )
+        return 0;
+      uint32_t len((p[0] << 8) | p[1]);
+      p += 2;
+      if( p+len > end )
+        return 0;
+      for(uint32_t b=0;b<nal_length_size;++b)
+        out.push_back( len >> (8*(nal_length_size-1-b)) );
+      out.insert(out.end(),p,p+len);
+      p += len;
+    }
+  }
+  return nal_length_size;
+}
+
+/**
+   Convert H.264 NAL units with start codes (encoder output) to length
+   prefixed NAL units.
+ */
+static void annexb_to_length_prefixed(const uint8_t* p, int size, uint32_t nal_length_size, std::vector<uint8_t>& out)
 {
+  const uint8_t* end(p+size);
+  const uint8_t* nal(NULL);
+  for(const uint8_t* c=p;c<=end;++c){
+    bool b_start((c+3 <= end) && (c[0] == 0) && (c[1] == 0) && (c[2] == 1));
+    if( b_start || (c == end) ){
+      if( nal ){
+        const uint8_t* nal_end(c);
+        // zero bytes before a start code belong to the start code:
+        while( (nal_end > nal) && (nal_end[-1] == 0) )
+          --nal_end;
+        uint32_t len(nal_end-nal);
+        for(uint32_t b=0;b<nal_length_size;++b)
+          out.push_back( len >> (8*(nal_length_size-1-b)) );
+        out.insert(out.end(),nal,nal_end);
+        nal = NULL;
+      }
+      if( b_start ){
+        c += 2;
+        nal = c+1;
+      }
+    }
+  }
+}
+
+writevideo_t::writevideo_t(const std::string& filename, AVFormatContext* ic, const std::vector<int>& streams )
+  : ic_(ic),
+    oc(NULL),
+    stream_map(ic->nb_streams,-1),
+    videoStream(-1),
+    enc(NULL),
+    nal_length_size(0),
+    b_restore_param_sets(false)
+{
+  avformat_alloc_output_context2(&oc, NULL, NULL, filename.c_str());
   if( !oc )
-    throw error_msg_t(__FILE__,__LINE__,"Memory error");
-  if (avio_open(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) 
-    throw error_msg_t(__FILE__,__LINE__,"Could not create output file '%s'.", filename.c_str());
-  AVCodec* codec(avcodec_find_encoder( srcCodec->codec_id ));
-  if( !codec )
-    throw error_msg_t(__FILE__,__LINE__,"Codec %d not found.",srcCodec->codec_id);
-  st = avformat_new_stream(oc, codec);
-  if (!st) {
-    fprintf(stderr, "Could not alloc stream\n");
-    exit(1);
+    throw error_msg_t(__FILE__,__LINE__,"Could not deduce output format from file name '%s'.", filename.c_str());
+  try{
+    for(uint32_t k=0;k<streams.size();++k){
+      AVStream* in(ic->streams[streams[k]]);
+      AVStream* out(avformat_new_stream(oc, in->codec->codec));
+      if( !out )
+        throw error_msg_t(__FILE__,__LINE__,"Could not allocate output stream.");
+      if( avcodec_copy_context( out->codec, in->codec ) < 0 )
+        throw error_msg_t(__FILE__,__LINE__,"Could not copy codec context.");
+      out->codec->codec_tag = 0;
+      out->time_base = in->time_base;
+      out->sample_aspect_ratio = in->sample_aspect_ratio;
+      if( oc->oformat->flags & AVFMT_GLOBALHEADER )
+        out->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+      stream_map[streams[k]] = out->index;
+      if( (videoStream < 0) && (in->codec->codec_type == AVMEDIA_TYPE_VIDEO) ){
+        videoStream = streams[k];
+        if( in->codec->codec_id == AV_CODEC_ID_H264 )
+          nal_length_size = avcc_param_sets(in->codec->extradata,in->codec->extradata_size,param_sets);
+      }
+    }
+    if( !(oc->oformat->flags & AVFMT_NOFILE) )
+      if( avio_open(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0 )
+        throw error_msg_t(__FILE__,__LINE__,"Could not create output file '%s'.", filename.c_str());
+    if( avformat_write_header(oc, NULL) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not write header of '%s'.", filename.c_str());
+  }
+  catch( ... ){
+    if( oc->pb && !(oc->oformat->flags & AVFMT_NOFILE) )
+      avio_close(oc->pb);
+    avformat_free_context(oc);
+    throw;
   }
-  
-  
+}
 
-  DEBUG(srcCodec->time_base.den);
-  DEBUG(srcCodec->time_base.num);
-  DEBUG(st->codec->time_base.den);
-  DEBUG(st->codec->time_base.num);
-  //AVCodecContext *c(st->codec);
-  //c->bit_rate = 400000;
-  //c->codec_id = srcCodec->codec_id;
-  //c->codec_type = srcCodec->codec_type;
-  //c->time_base.num = srcCodec->time_base.num;
-  //c->time_base.den = srcCodec->time_base.den;
-  //fprintf(stderr, "time_base.num = %d time_base.den = %d\n", c->time_base.num, c->time_base.den);
-  //c->width = srcCodec->width;
-  //c->height = srcCodec->height;
-  //c->pix_fmt = srcCodec->pix_fmt;
-  //printf("%d %d %d", c->width, c->height, c->pix_fmt);
-  //c->flags = srcCodec->flags;
-  //c->flags |= CODEC_FLAG_GLOBAL_HEADER;
-  //c->me_range = srcCodec->me_range;
-  //c->max_qdiff = srcCodec->max_qdiff;
-  //
-  //c->qmin = srcCodec->qmin;
-  //c->qmax = srcCodec->qmax;
-  //
-  //c->qcompress = srcCodec->qcompress;
-  //
-  //c->extradata = srcCodec->extradata;
-  //c->extradata_size = srcCodec->extradata_size;
+int writevideo_t::add_packet(const AVPacket* pkt, double offset)
+{
+  if( (pkt->stream_index < 0) || (pkt->stream_index >= (int)stream_map.size()) || (stream_map[pkt->stream_index] < 0) )
+    return 0;
+  AVStream* in(ic_->streams[pkt->stream_index]);
+  AVStream* out(oc->streams[stream_map[pkt->stream_index]]);
+  int64_t shift(llrint(offset/av_q2d(in->time_base)));
+  // the muxer takes ownership of the packet data, thus copy it:
+  AVPacket opkt;
+  av_init_packet(&opkt);
+  if( av_copy_packet(&opkt, pkt) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Could not copy packet.");
+  if( b_restore_param_sets && (pkt->stream_index == videoStream) && (pkt->flags & AV_PKT_FLAG_KEY) ){
+    // the decoder still has the parameter sets of the re-encoded frames:
+    if( av_grow_packet(&opkt, param_sets.size()) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Could not copy packet.");
+    memmove(opkt.data+param_sets.size(), opkt.data, pkt->size);
+    memcpy(opkt.data, &(param_sets[0]), param_sets.size());
+    b_restore_param_sets = false;
+  }
+  if( pkt->pts != AV_NOPTS_VALUE )
+    opkt.pts = av_rescale_q(pkt->pts+shift, in->time_base, out->time_base);
+  if( pkt->dts != AV_NOPTS_VALUE )
+    opkt.dts = av_rescale_q(pkt->dts+shift, in->time_base, out->time_base);
+  opkt.duration = av_rescale_q(pkt->duration, in->time_base, out->time_base);
+  opkt.stream_index = out->index;
+  opkt.pos = -1;
+  return av_interleaved_write_frame(oc, &opkt);
+}
 
-  avcodec_copy_context( st->codec, srcCodec );
-  DEBUG(st->codec->time_base.den);
-  DEBUG(st->codec->time_base.num);
-  //st->codec->time_base.den = fps_den;
-  //st->codec->time_base.num = fps_num;
-  DEBUG(st->codec->time_base.den);
-  DEBUG(st->codec->time_base.num);
-  //st->time_base = st->codec->time_base;
-  /* open the codec */
-  AVDictionary* d(NULL); // "create" an empty dictionary
-  av_dict_set(&d, "vpre", "fast", 0); // add an entry
-  av_dict_set(&d, "me_range", "16", 0); // add an entry
-  av_dict_set(&d, "qdiff", "4", 0); // add an entry
-  av_dict_set(&d, "qmin", "10", 0); // add an entry
-  av_dict_set(&d, "qmax", "51", 0); // add an entry
-  if (avcodec_open2( st->codec, codec, &d ) < 0)
-    throw error_msg_t(__FILE__,__LINE__, "could not open codec.");
-  /* Write the stream header, if any. */
-  DEBUG(1);
-  avformat_write_header(oc, NULL);
-  DEBUG(1);
+void writevideo_t::open_encoder()
+{
+  AVStream* in(ic_->streams[videoStream]);
+  AVCodec* codec(avcodec_find_encoder( in->codec->codec_id ));
+  if( !codec )
+    throw error_msg_t(__FILE__,__LINE__,"Encoder for codec %d not found.",in->codec->codec_id);
+  enc = avcodec_alloc_context3( codec );
+  if( !enc )
+    throw error_msg_t(__FILE__,__LINE__,"Memory error");
+  enc->width = in->codec->width;
+  enc->height = in->codec->height;
+  enc->pix_fmt = in->codec->pix_fmt;
+  enc->sample_aspect_ratio = in->codec->sample_aspect_ratio;
+  enc->profile = in->codec->profile;
+  enc->level = in->codec->level;
+  enc->bit_rate = in->codec->bit_rate;
+  // some encoders limit the time base, thus use the frame rate if known:
+  if( in->avg_frame_rate.num && in->avg_frame_rate.den )
+    enc->time_base = av_inv_q(in->avg_frame_rate);
+  else
+    enc->time_base = in->time_base;
+  // only a part of a GOP is encoded; no B-frames, so that decoding
+  // order equals presentation order:
+  enc->gop_size = 0x7fff;
+  enc->max_b_frames = 0;
+  AVDictionary* d(NULL);
+  av_dict_set(&d, "me_range", "16", 0);
+  av_dict_set(&d, "qdiff", "4", 0);
+  av_dict_set(&d, "qmin", "10", 0);
+  av_dict_set(&d, "qmax", "51", 0);
+  if( !enc->bit_rate )
+    av_dict_set(&d, "crf", "18", 0);
+  int err(avcodec_open2( enc, codec, &d ));
+  av_dict_free(&d);
+  if( err < 0 ){
+    av_free(enc);
+    enc = NULL;
+    throw error_msg_t(__FILE__,__LINE__,"Could not open encoder %s.",codec->name);
+  }
 }
 
-int writevideo_t::add_frame(AVFrame* frame)
+int writevideo_t::add_frame(AVFrame* frame, double offset, int64_t dts_delay)
 {
-//  /* encode the image */
-//  uint32_t out_size = avcodec_encode_video( st->codec, video_outbuf,
-//                                            video_outbuf_size, frame );
-//    /* If size is zero, it means the image was buffered. */
-//    if (out_size > 0) {
-//      AVPacket pkt;
-//      av_init_packet(&pkt);
-//      if (c->coded_frame->pts != AV_NOPTS_VALUE)
-//	pkt.pts = av_rescale_q(c->coded_frame->pts,
-//			       c->time_base, st->time_base);
-//      if (c->coded_frame->key_frame)
-//	pkt.flags |= AV_PKT_FLAG_KEY;
-//      pkt.stream_index = st->index;
-//      pkt.data = video_outbuf;
-//      pkt.size = out_size;
-//      /* Write the compressed frame to the media file. */
-//      ret = av_interleaved_write_frame(oc, &pkt);
-//    } else {
-//      ret = 0;
-//    }
-//  }
-//  //st->codec->time_base.den = fps_den;
-//  //st->codec->time_base.num = fps_num;
-//  //pkt->pts = frameno*st->codec->time_base.den/st->codec->time_base.num;
-//  //pkt->dts = pkt->pts;
-//  pkt->pts = AV_NOPTS_VALUE;
-//  pkt->dts = AV_NOPTS_VALUE;
-//  pkt->stream_index = 0;
-//  pkt->flags |= AV_PKT_FLAG_KEY;
-//  ++frameno;
-//  return av_interleaved_write_frame(oc, pkt);
+  if( videoStream < 0 )
+    return 0;
+  // the first frame must be a key frame, the encoder chooses the others:
+  frame->pict_type = enc ? AV_PICTURE_TYPE_NONE : AV_PICTURE_TYPE_I;
+  if( !enc )
+    open_encoder();
+  frame->pts = av_rescale_q(frame->pts, ic_->streams[videoStream]->time_base, enc->time_base);
+  AVPacket pkt;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  int got_packet(0);
+  if( avcodec_encode_video2(enc, &pkt, frame, &got_packet) < 0 )
+    throw error_msg_t(__FILE__,__LINE__,"Error while encoding.");
+  if( got_packet )
+    return write_encoded(&pkt, offset, dts_delay);
   return 0;
 }
 
+int writevideo_t::flush_frames(double offset, int64_t dts_delay)
+{
+  if( !enc )
+    return 0;
+  int ret(0);
+  int got_packet(1);
+  while( (enc->codec->capabilities & CODEC_CAP_DELAY) && got_packet && (ret >= 0) ){
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    if( avcodec_encode_video2(enc, &pkt, NULL, &got_packet) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Error while encoding.");
+    if( got_packet )
+      ret = write_encoded(&pkt, offset, dts_delay);
+  }
+  avcodec_close(enc);
+  av_free(enc);
+  enc = NULL;
+  b_restore_param_sets = (nal_length_size > 0) && !param_sets.empty();
+  return ret;
+}
+
+/**
+   Write an encoded packet like a packet of the input video stream;
+   the packet is freed.
+ */
+int writevideo_t::write_encoded(AVPacket* pkt, double offset, int64_t dts_delay)
+{
+  AVRational tb(ic_->streams[videoStream]->time_base);
+  pkt->pts = av_rescale_q(pkt->pts, enc->time_base, tb);
+  // decoding order is presentation order, but the copied packets
+  // which follow are decoded with a delay:
+  pkt->dts = pkt->pts - dts_delay;
+  pkt->duration = av_rescale_q(pkt->duration, enc->time_base, tb);
+  pkt->stream_index = videoStream;
+  if( nal_length_size ){
+    std::vector<uint8_t> buf;
+    annexb_to_length_prefixed(pkt->data, pkt->size, nal_length_size, buf);
+    AVPacket cpkt;
+    if( av_new_packet(&cpkt, buf.size()) < 0 )
+      throw error_msg_t(__FILE__,__LINE__,"Memory error");
+    memcpy(cpkt.data, &(buf[0]), buf.size());
+    cpkt.pts = pkt->pts;
+    cpkt.dts = pkt->dts;
+    cpkt.duration = pkt->duration;
+    cpkt.flags = pkt->flags;
+    cpkt.stream_index = pkt->stream_index;
+    av_free_packet(pkt);
+    *pkt = cpkt;
+  }
+  int ret(add_packet(pkt, offset));
+  av_free_packet(pkt);
+  return ret;
+}
+
 writevideo_t::~writevideo_t()
 {
+  if( enc ){
+    avcodec_close(enc);
+    av_free(enc);
+  }
   av_write_trailer(oc);
-//  //close_video(oc, video_st);
-//  for (uint32_t i = 0; i < oc->nb_streams; i++) {
-//    av_freep(&oc->streams[i]->codec);
-//    av_freep(&oc->streams[i]);
-//  }
   /* Close the output file. */
-  avio_close(oc->pb);
+  if( !(oc->oformat->flags & AVFMT_NOFILE) )
+    avio_close(oc->pb);
   /* free the stream */
-  av_free(oc);
+  avformat_free_context(oc);
 }
 
 // Local Variables:
@@ -2,6 +2,7 @@
 #define WRITEVIDEO_H
 
 #include <string>
+#include <vector>
 
 extern "C" {
 
@@ -10,16 +11,57 @@ extern "C" {
 
 }
 
+/**
+   Output file which receives compressed packets of some streams of an
+   input file without decoding or encoding (stream copy).
+
+   Decoded video frames can be inserted with add_frame(); they are
+   encoded with the codec and parameters of the input video stream.
+ */
 class writevideo_t {
 public:
-  writevideo_t( const std::string& filename, const AVCodecContext* srcCodec, uint64_t fps_den, uint64_t fps_num );
-  int add_frame( AVFrame* pkt );
+  /**
+     @param filename Output file name, the container format is guessed from the extension
+     @param ic Input format context
+     @param streams Indices of the input streams to be copied
+   */
+  writevideo_t( const std::string& filename, AVFormatContext* ic, const std::vector<int>& streams );
+  /**
+     Write a packet of one of the copied input streams.
+
+     @param pkt Input packet; it remains owned by the caller
+     @param offset Time offset added to the time stamps, in seconds
+   */
+  int add_packet( const AVPacket* pkt, double offset );
+  /**
+     Encode a decoded frame of the input video stream.
+
+     @param frame Decoded frame, time stamps in the input stream time base
+     @param offset Time offset added to the time stamps, in seconds
+     @param dts_delay Decoding delay of the copied packets, in the input stream time base
+   */
+  int add_frame( AVFrame* frame, double offset, int64_t dts_delay );
+  /**
+     Write frames delayed by the encoder and close the encoder; must
+     be called before further packets are copied to the video stream.
+   */
+  int flush_frames( double offset, int64_t dts_delay );
   ~writevideo_t();
 private:
+  void open_encoder();
+  int write_encoded( AVPacket* pkt, double offset, int64_t dts_delay );
+  AVFormatContext* ic_;
   AVFormatContext* oc;
-  AVStream* st;
-  uint64_t frameno;
-  uint8_t *video_outbuf;
+  // output stream index for each input stream, or -1:
+  std::vector<int> stream_map;
+  int videoStream;
+  AVCodecContext* enc;
+  // H.264 with length prefixed NAL units (MP4, Matroska), or 0:
+  uint32_t nal_length_size;
+  // SPS and PPS of the input stream, length prefixed:
+  std::vector<uint8_t> param_sets;
+  // the next copied key frame needs the input parameter sets:
+  bool b_restore_param_sets;
 };
 
 #endif